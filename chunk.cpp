@@ -3,16 +3,27 @@
 #include "util.hpp"
 #include "camera.hpp"
 #include "scene.hpp"
+#include "profiler.hpp"
 #include <string.h>
 
 float    Chunk::l0 = 1.0f;
 int      Chunk::size = 32;
 unsigned Chunk::program = 0;
+unsigned Chunk::depth_program = 0;
+bool     Chunk::depth_only = false;
+bool     Chunk::defer_upload = false;
+
+GLuint   ChunkArena::vao = 0, ChunkArena::vbo = 0;
+unsigned ChunkArena::capacity = 0, ChunkArena::used = 0;
+std::map<unsigned, unsigned> ChunkArena::free_ranges;
+int      ChunkArena::multi_draw_indirect = -1;
+GLuint   ChunkDrawList::offset_vbo = 0, ChunkDrawList::indirect_buffer = 0;
 
 extern bool IsGL();
 extern bool IsD3D11();
 extern bool IsD3D12();
 extern Camera* GetCurrentSceneCamera();
+extern bool g_debug;
 
 #ifdef WIN32
 #include <wrl/client.h>
@@ -32,7 +43,7 @@ using Microsoft::WRL::ComPtr;
 #endif
 
 Chunk::Chunk() {
-  vao = vbo = tri_count = 0;
+  tri_count = arena_first = arena_count = 0;
 #ifdef WIN32
   d3d11_vertex_buffer = nullptr;
 #endif
@@ -41,24 +52,25 @@ Chunk::Chunk() {
   memset(block, 0x00, sizeof(char)*size*size*size);
   memset(light, 0x00, sizeof(int) *size*size*size);
   is_dirty = true;
+  upload_pending = false;
+}
+
+Chunk::~Chunk() {
+  if (arena_count > 0) ChunkArena::Free(arena_first, arena_count);
+  delete[] block;
+  delete[] light;
 }
 
 void Chunk::BuildBuffers(Chunk* neighbors[26]) {
+  PROFILE_SCOPE("BuildBuffers");
+  std::vector<float> packed;
+  BuildVertices(neighbors, &packed);
+  SetVertices(packed);
+}
+
+// 只在 CPU 上生成顶点，不碰 GPU 也不改这个 Chunk；返回三角形数
+unsigned Chunk::BuildVertices(Chunk* neighbors[26], std::vector<float>* packed) {
   bool is_gl = IsGL();
-  if (is_gl) {
-    if (vbo != (unsigned)-999) {
-      glDeleteBuffers(1, &vbo);
-      glDeleteVertexArrays(1, &vao);
-      vao = vbo = 0;
-    }
-  }
-  else {
-    #ifdef WIN32
-    if (d3d11_vertex_buffer != nullptr) {
-      //d3d11_vertex_buffer->Release(); // TODO: 为什么导致crash
-    }
-    #endif
-  }
 
   // axis=0  x=u y=v z=w
   // axis=1  x=w y=u z=v
@@ -77,7 +89,7 @@ void Chunk::BuildBuffers(Chunk* neighbors[26]) {
   int  * tmp_data = new int[SIZE * 36];
   int  * tmp_ao   = new int[SIZE * 36];
   int idx_v = 0, idx_n = 0, idx_data = 0, idx_ao = 0;
-  tri_count = 0;
+  unsigned tris = 0;
 
   const float coord_min = 0;//(size-1) * l0 * 0.5f;
   for (int aidx = 0; aidx < 3; aidx++) {
@@ -206,7 +218,7 @@ void Chunk::BuildBuffers(Chunk* neighbors[26]) {
                 tmp_ao[idx_ao++]     = ao_factors[i + d*6];
                 tmp_data[idx_data++] = voxel;
               }
-              tri_count += 2;
+              tris += 2;
 
               // Clear scratch
               for (int uu=u; uu<u+du; uu++)
@@ -219,8 +231,9 @@ void Chunk::BuildBuffers(Chunk* neighbors[26]) {
     }
   }
 
-  float* tmp_packed = new float[tri_count * 3 * 6];
-  for (int i=0; i<tri_count*3; i++) {
+  packed->resize(size_t(tris) * 3 * 6);
+  float* tmp_packed = packed->data();
+  for (int i=0; i<tris*3; i++) {
     const float x=tmp_vert[i*3], y=tmp_vert[i*3+1], z=tmp_vert[i*3+2],
                 nidx = tmp_norm[i],
                 data = tmp_data[i],
@@ -243,36 +256,30 @@ void Chunk::BuildBuffers(Chunk* neighbors[26]) {
     }
   }
 
-  if (is_gl) {
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*tri_count * 3 * 6,
-      tmp_packed, GL_STATIC_DRAW);
-    const size_t stride = sizeof(float) * 6;
-
-    // XYZ pos
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
-    glEnableVertexAttribArray(0);
-
-    // Normal idx
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
-
-    // Data
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(4 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(2);
-
-    // AO Index
-    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(5 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(3);
+  delete[] tmp_vert; delete[] tmp_norm; delete[] tmp_data; delete[] tmp_ao;
+  return tris;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+// packed: BuildVertices 生成的格式，每个顶点 6 个 float
+void Chunk::SetVertices(const std::vector<float>& packed) {
+  tri_count = unsigned(packed.size() / (3 * 6));
+  const float* tmp_packed = packed.data();
+  bool is_gl = IsGL();
+  if (!is_gl) {  // GL 的旧顶点在 UploadGL 里还给 ChunkArena
+    #ifdef WIN32
+    if (d3d11_vertex_buffer != nullptr) {
+      //d3d11_vertex_buffer->Release(); // TODO: 为什么导致crash
+    }
+    #endif
+  }
 
-    MyCheckGLError("Chunk::BuildBuffer");
+  if (is_gl) {
+    if (defer_upload) {
+      pending_vertices = packed;
+      upload_pending = true;
+    } else {
+      UploadGL(tmp_packed);
+    }
   }
   else {
     #ifdef WIN32
@@ -314,11 +321,16 @@ void Chunk::BuildBuffers(Chunk* neighbors[26]) {
     #endif
   }
 
-  delete[] tmp_vert; delete[] tmp_norm; delete[] tmp_data; delete[] tmp_ao;
-  delete[] tmp_packed;
   is_dirty = false;
 }
 
+void Chunk::UploadPending() {
+  if (!upload_pending) return;
+  UploadGL(pending_vertices.data());
+  std::vector<float>().swap(pending_vertices);
+  upload_pending = false;
+}
+
 int Chunk::GetOcclusionFactor(const float x0, const float y0, const float z0, const int dir,
   Chunk* neighs[26]) {
   const float coord_min = l0 * 0.5f;//(size) * l0 * 0.5f;
@@ -462,16 +474,204 @@ void Chunk::LoadDefault() {
   }
 }
 
+#ifndef CYCLIMB_HEADLESS
+// tmp_packed: tri_count*3 个顶点，每个 6 个 float
+void Chunk::UploadGL(const float* tmp_packed) {
+  if (arena_count > 0) ChunkArena::Free(arena_first, arena_count);
+  arena_first = arena_count = 0;
+  if (tri_count > 0) {
+    arena_count = tri_count * 3;
+    arena_first = ChunkArena::Alloc(arena_count);
+    ChunkArena::Upload(arena_first, arena_count, tmp_packed);
+  }
+  MyCheckGLError("Chunk::UploadGL");
+}
+
 void Chunk::Render(const glm::mat4& M) {
+  UploadPending();
   if (tri_count < 1) return;
-  glUseProgram(program);
-  GLuint mLoc = glGetUniformLocation(program, "M");
+  const unsigned prog = depth_only ? depth_program : program;
+  glUseProgram(prog);
+  GLuint mLoc = glGetUniformLocation(prog, "M");
+  glUniformMatrix4fv(mLoc, 1, GL_FALSE, &(M[0][0]));
+  glBindVertexArray(ChunkArena::vao);
+  glDrawArrays(GL_TRIANGLES, arena_first, tri_count * 3);
+  glBindVertexArray(0);
+  glUseProgram(0);
+}
+
+void Chunk::RenderInstanced(const glm::mat4& M, GLuint instance_vbo, const InstanceLayout& layout, int count) {
+  UploadPending();
+  if (tri_count < 1 || count < 1) return;
+  const unsigned prog = depth_only ? depth_program : program;
+  glUseProgram(prog);
+  GLuint mLoc = glGetUniformLocation(prog, "M");
   glUniformMatrix4fv(mLoc, 1, GL_FALSE, &(M[0][0]));
+  glBindVertexArray(ChunkArena::vao);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+  for (int i = 0; i < 3; i++) {
+    glVertexAttribPointer(4 + i, 1, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid*)(size_t)(layout.offsets[i]));
+    glVertexAttribDivisor(4 + i, 1);
+    glEnableVertexAttribArray(4 + i);
+  }
+  glDrawArraysInstanced(GL_TRIANGLES, arena_first, tri_count * 3, count);
+  // 关掉以后普通的 Draw 里这几个属性都是 0
+  for (int i = 0; i < 3; i++) glDisableVertexAttribArray(4 + i);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  glUseProgram(0);
+}
+
+//======================== ChunkArena =======
+
+void ChunkArena::Init() {
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  capacity = INITIAL_CAPACITY;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(capacity) * VERTEX_SIZE, nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  SetupAttributes();
+  free_ranges[0] = capacity;
+}
+
+void ChunkArena::SetupAttributes() {
   glBindVertexArray(vao);
-  glDrawArrays(GL_TRIANGLES, 0, tri_count * 3);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  // XYZ pos, Normal idx, Data, AO Index
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)0);
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)(3 * sizeof(GLfloat)));
+  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)(4 * sizeof(GLfloat)));
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)(5 * sizeof(GLfloat)));
+  for (int i = 0; i < 4; i++) glEnableVertexAttribArray(i);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+void ChunkArena::Grow(unsigned min_capacity) {
+  unsigned new_capacity = capacity;
+  while (new_capacity < min_capacity) new_capacity *= 2;
+  GLuint new_vbo;
+  glGenBuffers(1, &new_vbo);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+  glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(new_capacity) * VERTEX_SIZE, nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(capacity) * VERTEX_SIZE);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &vbo);
+  vbo = new_vbo;
+  SetupAttributes();
+  if (g_debug) printf("ChunkArena: %u -> %u vertices\n", capacity, new_capacity);
+  // 新加的一段接到最后一个空闲区间上
+  auto last = free_ranges.empty() ? free_ranges.end() : std::prev(free_ranges.end());
+  if (last != free_ranges.end() && last->first + last->second == capacity) last->second += new_capacity - capacity;
+  else free_ranges[capacity] = new_capacity - capacity;
+  capacity = new_capacity;
+}
+
+unsigned ChunkArena::Alloc(unsigned num_verts) {
+  if (vao == 0) Init();
+  const unsigned n = (num_verts + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+  while (true) {
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+      if (it->second < n) continue;
+      const unsigned first = it->first, left = it->second - n;
+      free_ranges.erase(it);
+      if (left > 0) free_ranges[first + n] = left;
+      used += n;
+      return first;
+    }
+    Grow(capacity + n);
+  }
+}
+
+void ChunkArena::Free(unsigned first, unsigned num_verts) {
+  unsigned n = (num_verts + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+  used -= n;
+  auto next = free_ranges.lower_bound(first);
+  if (next != free_ranges.end() && first + n == next->first) {
+    n += next->second;
+    next = free_ranges.erase(next);
+  }
+  if (next != free_ranges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == first) {
+      prev->second += n;
+      return;
+    }
+  }
+  free_ranges[first] = n;
+}
+
+void ChunkArena::Upload(unsigned first, unsigned num_verts, const float* data) {
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, GLintptr(first) * VERTEX_SIZE, GLsizeiptr(num_verts) * VERTEX_SIZE, data);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool ChunkArena::HasMultiDrawIndirect() {
+  if (multi_draw_indirect == -1) {
+    multi_draw_indirect = (GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance)) ? 1 : 0;
+    if (g_debug) printf("Chunk draws: %s\n", multi_draw_indirect ? "glMultiDrawArraysIndirect" : "glDrawArrays");
+  }
+  return multi_draw_indirect == 1;
+}
+
+void ChunkDrawList::Add(Chunk* c, const glm::vec3& offset) {
+  c->UploadPending();
+  if (c->tri_count < 1) return;
+  const Command cmd = { c->tri_count * 3, 1, c->arena_first, GLuint(offsets.size()) };
+  cmds.push_back(cmd);
+  offsets.push_back(offset);
+}
+
+void ChunkDrawList::Submit(const glm::mat4& M) {
+  if (cmds.empty()) return;
+  const unsigned prog = Chunk::depth_only ? Chunk::depth_program : Chunk::program;
+  glUseProgram(prog);
+  GLuint mLoc = glGetUniformLocation(prog, "M");
+  glUniformMatrix4fv(mLoc, 1, GL_FALSE, &(M[0][0]));
+  glBindVertexArray(ChunkArena::vao);
+  if (ChunkArena::HasMultiDrawIndirect()) {
+    if (offset_vbo == 0) {
+      glGenBuffers(1, &offset_vbo);
+      glGenBuffers(1, &indirect_buffer);
+    }
+    // 每次都整个重新指定，驱动可以换一块新的，不用等上一批画完
+    glBindBuffer(GL_ARRAY_BUFFER, offset_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * offsets.size(), offsets.data(), GL_STREAM_DRAW);
+    for (int i = 0; i < 3; i++) {
+      glVertexAttribPointer(4 + i, 1, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)(sizeof(float) * i));
+      glVertexAttribDivisor(4 + i, 1);
+      glEnableVertexAttribArray(4 + i);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(Command) * cmds.size(), cmds.data(), GL_STREAM_DRAW);
+    glMultiDrawArraysIndirect(GL_TRIANGLES, (GLvoid*)0, GLsizei(cmds.size()), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    for (int i = 0; i < 3; i++) glDisableVertexAttribArray(4 + i);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  } else {
+    for (size_t i = 0; i < cmds.size(); i++) {
+      for (int j = 0; j < 3; j++) glVertexAttrib1f(4 + j, offsets[i][j]);
+      glDrawArrays(GL_TRIANGLES, cmds[i].first, cmds[i].count);
+    }
+    for (int j = 0; j < 3; j++) glVertexAttrib1f(4 + j, 0);
+  }
   glBindVertexArray(0);
   glUseProgram(0);
+  MyCheckGLError("ChunkDrawList::Submit");
 }
+#else
+// 无头版本没有 GL：defer_upload 开着，顶点一直留在 CPU 上，ChunkArena 是空的，也不会画
+void Chunk::UploadGL(const float* tmp_packed) { }
+void Chunk::Render(const glm::mat4& M) { }
+void Chunk::RenderInstanced(const glm::mat4& M, GLuint instance_vbo, const InstanceLayout& layout, int count) { }
+void ChunkArena::Free(unsigned first, unsigned num_verts) { }
+void ChunkDrawList::Add(Chunk* c, const glm::vec3& offset) { }
+void ChunkDrawList::Submit(const glm::mat4& M) { }
+#endif
 
 void Chunk::Render() {
   glm::mat4 M(1);
@@ -489,6 +689,17 @@ void Chunk::Render_D3D11(const DirectX::XMMATRIX& M) {
   g_context11->Draw(3 * tri_count, 0);
 }
 
+void Chunk::RenderInstanced_D3D11(const DirectX::XMMATRIX& M, ID3D11Buffer* instance_buffer, const InstanceLayout& layout, int count) {
+  if (tri_count < 1 || count < 1) return;
+  UpdateGlobalPerObjectCB(&M, nullptr, nullptr);
+  ID3D11Buffer* buffers[] = { d3d11_vertex_buffer, instance_buffer, instance_buffer, instance_buffer };
+  unsigned strides[] = { sizeof(float) * 6, unsigned(layout.stride), unsigned(layout.stride), unsigned(layout.stride) };
+  unsigned offsets[] = { 0, unsigned(layout.offsets[0]), unsigned(layout.offsets[1]), unsigned(layout.offsets[2]) };
+  g_context11->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  g_context11->IASetVertexBuffers(0, 4, buffers, strides, offsets);
+  g_context11->DrawInstanced(3 * tri_count, count, 0, 0);
+}
+
 void Chunk::Render_D3D11() {
   DirectX::XMMATRIX M = DirectX::XMMatrixIdentity();
   M *= DirectX::XMMatrixTranslation(pos.x, pos.y, -pos.z);
@@ -528,8 +739,9 @@ int Chunk::GetVoxel(unsigned x, unsigned y, unsigned z) {
 
 Chunk::Chunk(Chunk& other) {
   is_dirty = true;
+  upload_pending = false;
   pos = other.pos;
-  tri_count = vao = vbo = 0;
+  tri_count = arena_first = arena_count = 0;
   block = new unsigned char[size*size*size];
   light = new int[size*size*size];
   memcpy(block, other.block, sizeof(char)*size*size*size);
@@ -541,6 +753,7 @@ void Chunk::Fill(int vox) {
   is_dirty = true;
 }
 
+#ifdef WIN32
 void ChunkPass::AllocateConstantBuffers(int n) {
   num_max_chunks = n;
   CE(g_device12->CreateCommittedResource(
@@ -669,3 +882,4 @@ void ChunkPass::InitD3D12DefaultPalette() {
   CE(default_palette_VS->Release());
   CE(default_palette_PS->Release());
 }
+#endif
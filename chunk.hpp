@@ -2,10 +2,15 @@
 #define _CHUNK_HPP
 
 #define GLM_FORCE_RADIANS
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <map>
 #ifdef WIN32
 #include <d3d11.h>
 #include <d3d12.h>
@@ -15,15 +20,63 @@
 #undef max
 #undef min
 
+#ifdef WIN32
 struct PerObjectCB {
   DirectX::XMMATRIX M, V, P;
 };
+#endif
 
 // Vertex format: 12 floats per vertex
 // X X X Y Y Y Z Z Z NormalIDX Data AO
 
 class Chunk;
 
+// 实例化绘制时，每份的世界坐标偏移 x、y、z 在缓冲里的位置（字节）
+struct InstanceLayout {
+  int stride;
+  int offsets[3];
+};
+
+// GL 下所有 Chunk 的顶点都在同一个大缓冲里，共用一个 VAO，BuildBuffers 不再建删 GL 对象。
+// 按顶点分配，空闲区间放在 free_ranges 里（起点 -> 长度），释放时和相邻的合并，
+// 分配时取第一个够大的；都不够就把缓冲加倍，旧内容用 glCopyBufferSubData 拷过去。
+class ChunkArena {
+public:
+  static const unsigned VERTEX_SIZE = sizeof(float) * 6;
+  static const unsigned GRANULARITY = 96;           // 分配的顶点数按这个取整，碎片少一些
+  static const unsigned INITIAL_CAPACITY = 1 << 18; // 顶点
+  static unsigned Alloc(unsigned num_verts);        // 返回起始顶点
+  static void Free(unsigned first, unsigned num_verts);
+  static void Upload(unsigned first, unsigned num_verts, const float* data);
+  static bool HasMultiDrawIndirect();
+  static GLuint vao, vbo;
+  static unsigned capacity, used;  // 顶点
+private:
+  static std::map<unsigned, unsigned> free_ranges;
+  static int multi_draw_indirect;  // -1: 还没查
+  static void Init();
+  static void Grow(unsigned min_capacity);
+  static void SetupAttributes();
+};
+
+// 用同一个 M 的一批 Chunk，各自的世界坐标偏移走实例属性 4~6（和粒子一样）。
+// 有 ARB_multi_draw_indirect + ARB_base_instance 时整批一次 glMultiDrawArraysIndirect，
+// 每条命令的 baseInstance 指向自己的偏移；没有就在同一个 VAO 上一个一个画，偏移用常量属性
+class ChunkDrawList {
+public:
+  void Clear() { cmds.clear(); offsets.clear(); }
+  void Add(Chunk* c, const glm::vec3& offset);
+  void Submit(const glm::mat4& M);
+private:
+  struct Command {  // DrawArraysIndirectCommand
+    GLuint count, instance_count, first, base_instance;
+  };
+  std::vector<Command> cmds;
+  std::vector<glm::vec3> offsets;
+  static GLuint offset_vbo, indirect_buffer;
+};
+
+#ifdef WIN32
 // For D3D12
 class ChunkPass {
 public:
@@ -49,6 +102,7 @@ public:
   std::vector<Chunk*> chunk_instances;
   std::vector<PerObjectCB> chunk_per_object_cbs;
 };
+#endif
 
 class Chunk {
 public:
@@ -57,14 +111,24 @@ public:
   static int size;
   Chunk();
   Chunk(Chunk& other);
+  ~Chunk();
   void LoadDefault();
   static unsigned program;
-  void BuildBuffers(Chunk* neighbors[26]);
+  static unsigned depth_program;  // 只输出深度，阴影 Pass 用
+  static bool depth_only;         // 为 true 时 Render 用 depth_program
+  static bool defer_upload;       // 为 true 时 SetVertices 只留下顶点，第一次画之前才传给 GPU（无头模式一直不传）
+  void BuildBuffers(Chunk* neighbors[26]);  // = BuildVertices + SetVertices
+  unsigned BuildVertices(Chunk* neighbors[26], std::vector<float>* packed);
+  void SetVertices(const std::vector<float>& packed);
+  void UploadPending();
   void Render();
   void Render(const glm::mat4& M);
+  // 同一个 Chunk 画 count 份（粒子）。每份的世界坐标偏移在 instance_vbo 里，位置见 layout
+  void RenderInstanced(const glm::mat4& M, GLuint instance_vbo, const InstanceLayout& layout, int count);
 #ifdef WIN32
   void Render_D3D11();
   void Render_D3D11(const DirectX::XMMATRIX& M);
+  void RenderInstanced_D3D11(const DirectX::XMMATRIX& M, ID3D11Buffer* instance_buffer, const InstanceLayout& layout, int count);
   void RecordRenderCommand_D3D12(ChunkPass* pass, const DirectX::XMMATRIX& V, const DirectX::XMMATRIX& P);
   void RecordRenderCommand_D3D12(ChunkPass* pass, const DirectX::XMMATRIX& M, const DirectX::XMMATRIX& V, const DirectX::XMMATRIX& P);
 #endif
@@ -74,8 +138,11 @@ public:
   bool is_dirty;
   unsigned char* block;
   unsigned tri_count;
+  unsigned arena_first, arena_count;  // GL 顶点在 ChunkArena 里的位置
 private:
-  unsigned vao, vbo;
+  std::vector<float> pending_vertices;  // defer_upload 时还没传的顶点
+  bool upload_pending;
+  void UploadGL(const float* tmp_packed);
 
 #ifdef WIN32
   ID3D11Buffer* d3d11_vertex_buffer;
@@ -1,10 +1,16 @@
 #include "chunkindex.hpp"
 #include "chunk.hpp"
+#include "camera.hpp"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <set>
 
+extern Camera* GetCurrentSceneCamera();
+
+float ChunkGrid::lod_focal_px = 0;
+float ChunkGrid::lod_max_voxel_px = 2.0f;
+
 unsigned DivUp(unsigned a, unsigned b) {
   return (a-1) / b + 1;
 }
@@ -27,9 +33,156 @@ void ChunkGrid::Render(
   M = glm::translate(M, glm::inverse(orientation) * pos / scale);
   M = glm::translate(M, -anchor);
 
+  // 先收集要画的 Chunk，每一级（M 不同）最后一次提交
+  static ChunkDrawList lists[NUM_LODS + 1];
+  for (ChunkDrawList& l : lists) l.Clear();
+  if (use_lod && lod_focal_px > 0) {
+    if (lod_version != version) BuildLODs();
+    const int f = 1 << NUM_LODS;  // 最粗一级的一格是 f*f*f 个 Chunk
+    const float unit_len = glm::length(glm::vec3(M[0]));
+    const glm::vec3 cam_pos = GetCurrentSceneCamera()->pos;
+    for (int cx=0; cx < DivUp(xdim, f); cx++)
+      for (int cy=0; cy < DivUp(ydim, f); cy++)
+        for (int cz=0; cz < DivUp(zdim, f); cz++)
+          RenderLODCell(lists, M, NUM_LODS, cx, cy, cz, cam_pos, unit_len);
+  } else {
+    for (int xx=0; xx < xdim; xx++) {
+      for (int yy=0; yy < ydim; yy++) {
+        for (int zz=0; zz < zdim; zz++) {
+          QueueChunk(&lists[0], M, xx, yy, zz);
+        }
+      }
+    }
+  }
+  for (int level = 0; level <= NUM_LODS; level++) {
+    lists[level].Submit(glm::scale(M, glm::vec3(float(1 << level))));
+  }
+}
+
+// Chunk 自己的平移换成世界坐标的偏移，这样同一个 M 的 Chunk 可以一起画
+void ChunkGrid::QueueChunk(ChunkDrawList* list, const glm::mat4& M, int xx, int yy, int zz) {
+  glm::vec3 tr(float(xx * Chunk::size),
+               float(yy * Chunk::size),
+               float(zz * Chunk::size));
+  Chunk* chk = chunks[IX(xx, yy, zz)];
+  if (chk->is_dirty) {
+    Chunk* neighs[26] = { NULL };
+    GetNeighbors(chk, neighs);
+    chk->BuildBuffers(neighs);
+  }
+  list->Add(chk, glm::vec3(M * glm::vec4(tr, 0.0f)));
+}
+
+// level 级的一格边长是 2^level 个 Chunk；粗一级的体素够小就整格画 LOD，否则拆成 8 个小格。
+// lists[level] 里的 Chunk 用 M 再放大 2^level 倍画
+void ChunkGrid::RenderLODCell(ChunkDrawList* lists, const glm::mat4& M, int level, int cx, int cy, int cz,
+    const glm::vec3& cam_pos, float unit_len) {
+  const int f = 1 << level;
+  if (cx*f >= int(xdim) || cy*f >= int(ydim) || cz*f >= int(zdim)) return;
+  if (level == 0) {
+    QueueChunk(&lists[0], M, cx, cy, cz);
+    return;
+  }
+  const float cell_len = float(f * Chunk::size);
+  const glm::vec3 center(M * glm::vec4((glm::vec3(cx, cy, cz) + 0.5f) * cell_len, 1.0f));
+  const float dist = std::max(glm::length(center - cam_pos), 1e-3f);
+  if (f * unit_len * lod_focal_px / dist <= lod_max_voxel_px) {
+    // LOD 网格里的一个 Chunk 正好盖住这一格
+    lods[level-1]->QueueChunk(&lists[level], glm::scale(M, glm::vec3(float(f))), cx, cy, cz);
+    return;
+  }
+  for (int i = 0; i < 8; i++) {
+    RenderLODCell(lists, M, level-1, cx*2 + (i & 1), cy*2 + ((i >> 1) & 1), cz*2 + ((i >> 2) & 1),
+      cam_pos, unit_len);
+  }
+}
+
+// 每 f*f*f 块合成一个体素：至少 1/4 是实心才算实心，颜色取出现最多的
+void ChunkGrid::BuildLODs() {
+  int counts[256] = { 0 };
+  std::vector<int> vals;
+  for (int k = 0; k < NUM_LODS; k++) {
+    const int f = 2 << k;
+    if (lods[k] == nullptr)
+      lods[k] = new ChunkGrid(DivUp(x_len, f), DivUp(y_len, f), DivUp(z_len, f));
+    ChunkGrid* lod = lods[k];
+    for (unsigned x=0; x < lod->x_len; x++) {
+      for (unsigned y=0; y < lod->y_len; y++) {
+        for (unsigned z=0; z < lod->z_len; z++) {
+          vals.clear();
+          for (int dx=0; dx < f; dx++)
+            for (int dy=0; dy < f; dy++)
+              for (int dz=0; dz < f; dz++) {
+                const int v = GetVoxel(x*f + dx, y*f + dy, z*f + dz) & 0xFF;
+                if (v) { vals.push_back(v); counts[v]++; }
+              }
+          int best = 0;
+          if (int(vals.size()) * 4 >= f*f*f) {
+            for (int v : vals) if (best == 0 || counts[v] > counts[best]) best = v;
+          }
+          for (int v : vals) counts[v] = 0;
+          lod->SetVoxel(x, y, z, best);
+        }
+      }
+    }
+    for (Chunk* c : lod->chunks) c->is_dirty = true;
+  }
+  lod_version = version;
+}
+
+int ChunkGrid::PickLOD(float unit_len, float dist) {
+  if (!use_lod || lod_focal_px <= 0) return 0;
+  dist = std::max(dist, 1e-3f);
+  int level = 0;
+  while (level < NUM_LODS && (2 << level) * unit_len * lod_focal_px / dist <= lod_max_voxel_px) level++;
+  return level;
+}
+
+void ChunkGrid::RenderMergedInstanced(
+    const glm::vec3& scale, const glm::mat3& orientation, const glm::vec3& anchor,
+    GLuint instance_vbo, const InstanceLayout& layout, int count, int level) {
+  if (level > 0 && lod_version != version) BuildLODs();
+  if (merged[level] == nullptr) merged[level] = new Chunk();
+  if (merged[level]->is_dirty || merged_version[level] != version) {
+    // 在 CPU 上重新生成各 Chunk 的顶点拼起来，不从 GPU 读回
+    ChunkGrid* g = (level == 0) ? this : lods[level-1];
+    std::vector<float> packed, part;
+    for (int xx=0; xx < g->xdim; xx++) {
+      for (int yy=0; yy < g->ydim; yy++) {
+        for (int zz=0; zz < g->zdim; zz++) {
+          Chunk* chk = g->chunks[g->IX(xx, yy, zz)];
+          Chunk* neighs[26] = { NULL };
+          g->GetNeighbors(chk, neighs);
+          chk->BuildVertices(neighs, &part);
+          const glm::vec3 offset = glm::vec3(xx, yy, zz) * float(Chunk::size);
+          for (size_t j = 0; j < part.size(); j += 6) {
+            part[j] += offset.x; part[j+1] += offset.y; part[j+2] += offset.z;
+          }
+          packed.insert(packed.end(), part.begin(), part.end());
+        }
+      }
+    }
+    merged[level]->SetVertices(packed);
+    merged_version[level] = version;
+  }
+
+  glm::mat4 M(orientation);
+  M = glm::scale(M, scale);
+  M = glm::translate(M, -anchor);
+  M = glm::scale(M, glm::vec3(float(1 << level)));
+  merged[level]->RenderInstanced(M, instance_vbo, layout, count);
+}
+
+void ChunkGrid::RenderInstanced(
+    const glm::vec3& scale, const glm::mat3& orientation, const glm::vec3& anchor,
+    GLuint instance_vbo, const InstanceLayout& layout, int count) {
+  glm::mat4 M(orientation);
+  M = glm::scale(M, scale);
+  M = glm::translate(M, -anchor);
+
   for (int xx=0; xx < xdim; xx++) {
     for (int yy=0; yy < ydim; yy++) {
-      for (int zz=0; zz < ydim; zz++) {
+      for (int zz=0; zz < zdim; zz++) {
         glm::vec3 tr(float(xx * Chunk::size),
                      float(yy * Chunk::size),
                      float(zz * Chunk::size));
@@ -41,7 +194,7 @@ void ChunkGrid::Render(
           GetNeighbors(chk, neighs);
           chk->BuildBuffers(neighs);
         }
-        chunks[ix]->Render(M_chunk);
+        chunks[ix]->RenderInstanced(M_chunk, instance_vbo, layout, count);
       }
     }
   }
@@ -49,6 +202,39 @@ void ChunkGrid::Render(
 
 #ifdef WIN32
 extern void GlmMat4ToDirectXMatrix(DirectX::XMMATRIX* out, const glm::mat4& m);
+void ChunkGrid::RenderInstanced_D3D11(
+  const glm::vec3& scale, const glm::mat3& orientation, const glm::vec3& anchor,
+  ID3D11Buffer* instance_buffer, const InstanceLayout& layout, int count) {
+
+  glm::mat4 M(orientation);
+  const float eps = 0.01f;
+  M = glm::scale(M, scale + glm::vec3(eps, eps, eps));
+  glm::vec3 anchor1 = anchor; anchor1.z = -anchor1.z;
+  M = glm::translate(M, -anchor1);
+
+  for (int xx = 0; xx < xdim; xx++) {
+    for (int yy = 0; yy < ydim; yy++) {
+      for (int zz = 0; zz < zdim; zz++) {
+        glm::vec3 tr(float(xx * Chunk::size),
+          float(yy * Chunk::size),
+          float(zz * Chunk::size) * -1);
+        glm::mat4 M_chunk = glm::translate(M, tr);
+        int ix = IX(xx, yy, zz);
+        Chunk* chk = chunks[ix];
+        if (chk->is_dirty) {
+          Chunk* neighs[26] = { NULL };
+          GetNeighbors(chk, neighs);
+          chk->BuildBuffers(neighs);
+        }
+
+        DirectX::XMMATRIX M1;
+        GlmMat4ToDirectXMatrix(&M1, M_chunk);
+        chunks[ix]->RenderInstanced_D3D11(M1, instance_buffer, layout, count);
+      }
+    }
+  }
+}
+
 void ChunkGrid::Render_D3D11(
   const glm::vec3& pos,  const glm::vec3& scale,
   const glm::mat3& orientation,  const glm::vec3& anchor) {
@@ -150,6 +336,7 @@ void ChunkGrid::RecordRenderCommand_D3D12(
 #endif
 
 Chunk* ChunkGrid::GetChunk(int x, int y, int z, int* local_x, int* local_y, int* local_z) {
+  if (x < 0 || y < 0 || z < 0) return NULL; // 除法向 0 取整，-1 会落进第 0 格
   int xx = x / Chunk::size,
       yy = y / Chunk::size,
       zz = z / Chunk::size;
@@ -170,6 +357,7 @@ void ChunkGrid::SetVoxel(unsigned x, unsigned y, unsigned z, int v) {
   Chunk* chk = GetChunk(x, y, z, &lx, &ly, &lz);
   if (chk)
     chk->SetVoxel(lx, ly, lz, v);
+  version++;
 }
 
 void ChunkGrid::SetVoxel(const glm::vec3& p, int vox) {
@@ -183,6 +371,7 @@ void ChunkGrid::SetVoxel(const glm::vec3& p, int vox) {
   if (ix >= 0 && ix < chunks.size()) {
     Chunk* chk = chunks.at(ix);
     chk->SetVoxel(local_x, local_y, local_z, vox);
+    version++;
     Chunk* neighs[26] = { NULL };
     GetNeighbors(chk, neighs);
     chk->BuildBuffers(neighs);
@@ -261,8 +450,7 @@ void ChunkGrid::Init(unsigned _xlen, unsigned _ylen, unsigned _zlen) {
 }
 
 ChunkGrid::ChunkGrid(const char* vox_fn) {
-  FILE* f;
-  fopen_s(&f, vox_fn, "rb");
+  FILE* f = fopen(vox_fn, "rb");
 
   long long file_size;
   fseek(f, 0, SEEK_END);
@@ -316,7 +504,7 @@ ChunkGrid::ChunkGrid(const char* vox_fn) {
             x = tmp & 0xFF;
         SetVoxel(x, y, z, val);
       }
-      delete xyzi;
+      delete[] xyzi;
       done = true;
     } else if (!strcmp(chunk, "RGBA")) {
       printf("RGBA Palette, skipped\n");
@@ -351,6 +539,22 @@ ChunkGrid::ChunkGrid(const ChunkGrid& other) {
   }
   xdim = other.xdim; ydim = other.ydim; zdim = other.zdim;
   x_len = other.x_len; y_len = other.y_len; z_len = other.z_len;
+  use_lod = other.use_lod;
+}
+
+ChunkGrid::~ChunkGrid() {
+  for (Chunk* c : chunks) delete c;
+  for (ChunkGrid* g : lods) delete g;
+  for (Chunk* c : merged) delete c;
+}
+
+void ChunkGrid::CopyVoxelsFrom(const ChunkGrid& other) {
+  assert(chunks.size() == other.chunks.size());
+  for (unsigned i=0; i<chunks.size(); i++) {
+    memcpy(chunks[i]->block, other.chunks[i]->block, sizeof(char)*Chunk::size*Chunk::size*Chunk::size);
+    chunks[i]->is_dirty = true;
+  }
+  version++;
 }
 
 void ChunkGrid::Fill(int vox) {
@@ -377,6 +581,7 @@ void ChunkGrid::Fill(int vox) {
     Chunk* dummy[26] = { NULL };
     c->BuildBuffers(dummy);
   }
+  version++;
 }
 
 void ChunkGrid::SetVoxelSphere(const glm::vec3& p, float radius, int v) {
@@ -390,6 +595,7 @@ void ChunkGrid::SetVoxelSphere(const glm::vec3& p, float radius, int v) {
           int lx, ly, lz;
           Chunk* chk = GetChunk(int(p.x+dx), int(p.y+dy), int(p.z+dz),
               &lx, &ly, &lz);
+          if (chk == NULL) continue; // 球伸出了格子
           touched.insert(chk);
           chk->SetVoxel(lx, ly, lz, v);
         }
@@ -398,6 +604,7 @@ void ChunkGrid::SetVoxelSphere(const glm::vec3& p, float radius, int v) {
     Chunk* dummy[26] = { NULL };
     c->BuildBuffers(dummy);
   }
+  version++;
 }
 
 void ChunkGrid::FromIX(int ix, int& x, int& y, int& z) {
@@ -87,12 +87,23 @@ public:
       const glm::vec3& scale,
       const glm::mat3& orientation,
       const glm::vec3& anchor) = 0;
+  // 在 pos = 0 处画 count 份，每份再平移 instance_vbo 里的偏移，见 Chunk::RenderInstanced
+  virtual void RenderInstanced(
+      const glm::vec3& scale,
+      const glm::mat3& orientation,
+      const glm::vec3& anchor,
+      GLuint instance_vbo, const InstanceLayout& layout, int count) = 0;
 #ifdef WIN32
   virtual void Render_D3D11(
     const glm::vec3& pos,
     const glm::vec3& scale,
     const glm::mat3& orientation,
     const glm::vec3& anchor) = 0;
+  virtual void RenderInstanced_D3D11(
+    const glm::vec3& scale,
+    const glm::mat3& orientation,
+    const glm::vec3& anchor,
+    ID3D11Buffer* instance_buffer, const InstanceLayout& layout, int count) = 0;
   virtual void RecordRenderCommand_D3D12(
     ChunkPass* chunk_pass,
     const glm::vec3& pos,
@@ -116,11 +127,17 @@ public:
   ChunkGrid(unsigned _xlen, unsigned _ylen, unsigned _zlen);
   ChunkGrid(const char* vox_fn);
   ChunkGrid(const ChunkGrid& other);
+  virtual ~ChunkGrid();
   virtual void Render(
     const glm::vec3& pos,
     const glm::vec3& scale,
     const glm::mat3& orientation,
     const glm::vec3& anchor);
+  virtual void RenderInstanced(
+    const glm::vec3& scale,
+    const glm::mat3& orientation,
+    const glm::vec3& anchor,
+    GLuint instance_vbo, const InstanceLayout& layout, int count);
 #ifdef WIN32
   virtual void Render_D3D11(
     const glm::vec3& pos,
@@ -128,6 +145,11 @@ public:
     const glm::mat3& orientation,
     const glm::vec3& anchor
   );
+  virtual void RenderInstanced_D3D11(
+    const glm::vec3& scale,
+    const glm::mat3& orientation,
+    const glm::vec3& anchor,
+    ID3D11Buffer* instance_buffer, const InstanceLayout& layout, int count);
   virtual void RecordRenderCommand_D3D12(
     ChunkPass* chunk_pass,
     const glm::vec3& pos,
@@ -143,6 +165,24 @@ public:
   virtual int  GetVoxel(unsigned x, unsigned y, unsigned z);
   virtual bool IntersectPoint(const glm::vec3& p);
   virtual void Fill(int vox);
+  void CopyVoxelsFrom(const ChunkGrid& other); // 大小要相同；不重新分配
+
+  // 远景用的 LOD：lods[k] 的一个体素对应原来 2^(k+1) 边长的一块，颜色取块里出现最多的。
+  // 开了以后 GL 的 Render 按每一块在屏幕上的大小选精细的还是粗的，体素改了以后下次画时重建。
+  static const int NUM_LODS = 2;
+  static float lod_focal_px;      // 距离为 1 处单位长度的像素数，render() 每帧设；0 表示不用 LOD
+  static float lod_max_voxel_px;  // 粗一级的体素不超过这么多像素就用粗的
+  void EnableLOD() { use_lod = true; }
+  int  PickLOD(float unit_len, float dist);  // 离相机 dist、一个体素长 unit_len 时该用哪一级，0 是原始精度
+
+  // 同一个模型画 count 份，每份的世界坐标偏移在 instance_vbo 里。
+  // 整个网格（level > 0 时是对应的 LOD）先拼成一个顶点缓冲，各 Chunk 的位置烘进顶点，
+  // 所以一共只有一次 Draw，和网格里有几个 Chunk、画几份都无关。只有 GL
+  void RenderMergedInstanced(
+    const glm::vec3& scale,
+    const glm::mat3& orientation,
+    const glm::vec3& anchor,
+    GLuint instance_vbo, const InstanceLayout& layout, int count, int level);
 protected:
   Chunk* GetChunk(int x, int y, int z, int* local_x, int* local_y, int* local_z);
   void Init(unsigned _xlen, unsigned _ylen, unsigned _zlen);
@@ -153,6 +193,17 @@ protected:
     return x*ydim*zdim + y*zdim + z;
   }
   void FromIX(int ix, int& x, int& y, int& z);
+
+  ChunkGrid* lods[NUM_LODS] = { nullptr, nullptr };
+  bool use_lod = false;
+  // 体素每改一次 version 加一；LOD 和拼好的网格记下自己是从哪个 version 建的
+  unsigned version = 0, lod_version = unsigned(-1);
+  Chunk* merged[NUM_LODS + 1] = { nullptr, nullptr, nullptr };
+  unsigned merged_version[NUM_LODS + 1];
+  void BuildLODs();
+  void QueueChunk(ChunkDrawList* list, const glm::mat4& M, int xx, int yy, int zz);
+  void RenderLODCell(ChunkDrawList* lists, const glm::mat4& M, int level, int cx, int cy, int cz,
+    const glm::vec3& cam_pos, float unit_len);
 };
 
 #endif
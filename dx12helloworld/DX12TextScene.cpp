@@ -244,16 +244,7 @@ void DX12TextScene::Render() {
   command_list->RSSetViewports(1, &viewport);
   command_list->RSSetScissorRects(1, &scissor);
   command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-  for (size_t i = 0; i < text_pass->characters_to_display.size(); i++) {
-    const TextPass::CharacterToDisplay& ctd = text_pass->characters_to_display[i];
-    command_list->IASetVertexBuffers(0, 1, &ctd.vbv);
-    command_list->SetGraphicsRootConstantBufferView(0, text_pass->per_scene_cbs->GetGPUVirtualAddress() + sizeof(TextCbPerScene) * ctd.per_scene_cb_index);
-    CD3DX12_GPU_DESCRIPTOR_HANDLE srv_handle(
-      text_pass->srv_heap->GetGPUDescriptorHandleForHeapStart(),
-      ctd.character->offset_in_srv_heap, srv_descriptor_size);
-    command_list->SetGraphicsRootDescriptorTable(1, srv_handle);
-    command_list->DrawInstanced(6, 1, 0, 0);
-  }
+  text_pass->RecordRenderCommands();
 
   command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
     g_rendertargets[g_frame_index],
@@ -10,6 +10,8 @@
 #include <math.h>
 #include "sprite.hpp"
 #include "scene.hpp"
+#include "particlekernel.hpp"
+#include "gpuparticles.hpp"
 #include <stddef.h>
 #ifdef WIN32
 #include <DirectXMath.h>
@@ -37,6 +39,9 @@ extern ID3D11DepthStencilView *g_dsv11;
 extern D3D11_RECT g_scissorrect11;
 extern ID3D11InputLayout* g_inputlayout_voxel11;
 extern ID3D11VertexShader* g_vs_default_palette;
+extern ID3D11VertexShader* g_vs_default_palette_instanced;
+extern ID3D11InputLayout* g_inputlayout_voxel_instanced11;
+extern ID3D11Device* g_device11;
 extern ID3D11PixelShader* g_ps_default_palette;
 extern ID3D11SamplerState* g_sampler11;
 extern ID3D11Buffer* g_perobject_cb_default_palette;
@@ -89,7 +94,126 @@ Particles* GetGlobalParticles();
 
 //======================== Particles =======
 
-Particles::Particles() { }
+ParticlePool::ParticlePool(ChunkIndex* _mesh) : mesh(_mesh), count(0) {
+  orientation = glm::mat3(1);
+  scale = glm::vec3(1, 1, 1);
+  anchor = mesh->Size() * 0.5f;
+  pos = glm::vec3(0, 0, 0);
+}
+
+CpuParticlePool::CpuParticlePool(ChunkIndex* _mesh) : ParticlePool(_mesh),
+  pos_x(CAPACITY), pos_y(CAPACITY), pos_z(CAPACITY),
+  vel_x(CAPACITY), vel_y(CAPACITY), vel_z(CAPACITY),
+  lifetime(CAPACITY), inv_lifetime_full(CAPACITY),
+  instances_dirty(true), instance_vbo(0) {
+#ifdef WIN32
+  instance_buffer11 = nullptr;
+#endif
+}
+
+bool CpuParticlePool::Add(const glm::vec3& p, const glm::vec3& v, float _lifetime) {
+  if (count >= CAPACITY || _lifetime <= 0) return false;
+  pos_x[count] = p.x; pos_y[count] = p.y; pos_z[count] = p.z;
+  vel_x[count] = v.x; vel_y[count] = v.y; vel_z[count] = v.z;
+  lifetime[count] = _lifetime;
+  inv_lifetime_full[count] = 1.0f / _lifetime;
+  count++;
+  instances_dirty = true;
+  return true;
+}
+
+// 速度按 (1 - completion)^2 衰减，completion = 1 - lifetime / lifetime_full
+void CpuParticlePool::Simulate(float secs) {
+  if (count == 0) return;
+  static const ParticleKernelFn kernel = GetParticleKernel();
+  float* px = pos_x.data(), *py = pos_y.data(), *pz = pos_z.data();
+  const float* vx = vel_x.data(), *vy = vel_y.data(), *vz = vel_z.data();
+  float* life = lifetime.data();
+  const float* inv_full = inv_lifetime_full.data();
+  const ParticleArrays arrays = { px, py, pz, vx, vy, vz, life, inv_full };
+  kernel(arrays, count, secs, secs * SIM_REF_FPS);
+
+  // 交换删除，顺序无所谓
+  int i = 0;
+  while (i < count) {
+    if (life[i] > 0) { i++; continue; }
+    const int last = --count;
+    px[i] = px[last]; py[i] = py[last]; pz[i] = pz[last];
+    vel_x[i] = vx[last]; vel_y[i] = vy[last]; vel_z[i] = vz[last];
+    life[i] = life[last];
+    inv_lifetime_full[i] = inv_full[last];
+  }
+  instances_dirty = true;
+}
+
+void CpuParticlePool::Render() {
+  if (count == 0) return;
+  const int bytes = sizeof(float) * CAPACITY;
+#ifndef CYCLIMB_HEADLESS
+  if (instance_vbo == 0) {
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, bytes * 3, nullptr, GL_STREAM_DRAW);
+    instances_dirty = true;
+  }
+  if (instances_dirty) { // 阴影和主 Pass 共用一次上传
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0,         sizeof(float) * count, pos_x.data());
+    glBufferSubData(GL_ARRAY_BUFFER, bytes,     sizeof(float) * count, pos_y.data());
+    glBufferSubData(GL_ARRAY_BUFFER, bytes * 2, sizeof(float) * count, pos_z.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    instances_dirty = false;
+  }
+#endif
+  const InstanceLayout layout = { sizeof(float), { 0, bytes, bytes * 2 } };
+  mesh->RenderInstanced(scale, orientation, anchor, instance_vbo, layout, count);
+}
+
+#ifdef WIN32
+void CpuParticlePool::Render_D3D11() {
+  if (count == 0) return;
+  if (instance_buffer11 == nullptr) {
+    D3D11_BUFFER_DESC desc = { };
+    desc.ByteWidth = sizeof(float) * CAPACITY * 3;
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    assert(SUCCEEDED(g_device11->CreateBuffer(&desc, nullptr, &instance_buffer11)));
+    instances_dirty = true;
+  }
+  if (instances_dirty) {
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    assert(SUCCEEDED(g_context11->Map(instance_buffer11, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)));
+    float* dst = (float*)(mapped.pData);
+    memcpy(dst,                pos_x.data(), sizeof(float) * count);
+    memcpy(dst + CAPACITY,     pos_y.data(), sizeof(float) * count);
+    memcpy(dst + CAPACITY * 2, pos_z.data(), sizeof(float) * count);
+    g_context11->Unmap(instance_buffer11, 0);
+    instances_dirty = false;
+  }
+  g_context11->VSSetShader(g_vs_default_palette_instanced, nullptr, 0);
+  g_context11->IASetInputLayout(g_inputlayout_voxel_instanced11);
+  const int bytes = sizeof(float) * CAPACITY;
+  const InstanceLayout layout = { sizeof(float), { 0, bytes, bytes * 2 } };
+  mesh->RenderInstanced_D3D11(scale, orientation, anchor, instance_buffer11, layout, count);
+  g_context11->VSSetShader(g_vs_default_palette, nullptr, 0);
+  g_context11->IASetInputLayout(g_inputlayout_voxel11);
+}
+
+// D3D12 的 ChunkPass 还没有实例化的管线，每个粒子记一条，不超过常量缓冲的容量
+void CpuParticlePool::RecordRenderCommand_D3D12(
+  ChunkPass* chunk_pass,
+  const DirectX::XMMATRIX& V,
+  const DirectX::XMMATRIX& P) {
+  for (int i = 0; i < count; i++) {
+    if (int(chunk_pass->chunk_instances.size()) >= chunk_pass->num_max_chunks) break;
+    mesh->RecordRenderCommand_D3D12(chunk_pass, glm::vec3(pos_x[i], pos_y[i], pos_z[i]),
+      scale, orientation, anchor, V, P);
+  }
+}
+#endif
+
+Particles::Particles() : rng(2463534242u) { }
 
 ChunkIndex* Particles::default_particle = NULL;
 
@@ -97,25 +221,37 @@ void Particles::InitStatic(ChunkIndex* x) {
   default_particle = x;
 }
 
+float Particles::Random01() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return (rng >> 8) * (1.0f / 16777216.0f);
+}
+
 void Particles::Spawn(ChunkIndex* src, const glm::vec3& pos, float lifetime, float v0) {
-  float randx = rand() * 1.0f / RAND_MAX, randy = rand() * 1.0f / RAND_MAX;
-  float cos_phi = cos(2.0 * 3.14159 * randx),
-        sin_phi = sin(2.0 * 3.14159 * randx),
-        cos_theta = 1.0f - randy,
-        sin_theta = sqrt(1.0f - cos_theta * cos_theta);
-  if (rand() * 1.0f / RAND_MAX > 0.5f) cos_theta = -cos_theta;
-  glm::vec3 dir(
-    sin_theta * cos_phi,
-    sin_theta * sin_phi,
-    cos_theta
-  );
-
-  State s;
-  s.lifetime = s.lifetime_full = lifetime;
-  s.sprite = new ChunkSprite(src);
-  s.sprite->vel = dir * v0;
-  s.sprite->pos = pos;
-  particles.push_back(s);
+  ParticlePool* pool = nullptr;
+  for (ParticlePool* p : pools) {
+    if (p->mesh == src) { pool = p; break; }
+  }
+  if (pool == nullptr) {
+#ifndef CYCLIMB_HEADLESS
+    if (g_gpu_particles && GpuParticlePool::IsSupported()) pool = new GpuParticlePool(src);
+    else
+#endif
+    pool = new CpuParticlePool(src);
+    pools.push_back(pool);
+  }
+
+  // 球内取点再归一化，得到球面上均匀的方向，不用三角函数
+  glm::vec3 dir;
+  float len_sq;
+  do {
+    dir = glm::vec3(Random01(), Random01(), Random01()) * 2.0f - 1.0f;
+    len_sq = glm::dot(dir, dir);
+  } while (len_sq > 1.0f || len_sq < 1e-6f);
+  dir *= 1.0f / sqrtf(len_sq);
+
+  pool->Add(pos, dir * v0, lifetime);
 }
 
 void Particles::SpawnDefaultSprite(const glm::vec3& pos, float lifetime, float v0) {
@@ -123,28 +259,11 @@ void Particles::SpawnDefaultSprite(const glm::vec3& pos, float lifetime, float v
 }
 
 void Particles::Update(float secs) {
-  for (State& s : particles) {
-    float completion = 1.0f - (s.lifetime / s.lifetime_full);
-    glm::vec3 vv = s.sprite->vel * (1.0f - completion) * (1.0f - completion);
-    s.sprite->pos += vv;
-    s.lifetime -= secs;
-    if (s.lifetime < 0) {
-      s.lifetime = 0;
-      delete s.sprite;
-    }
-  }
-  std::vector<State> next_state;
-  for (State& s : particles) {
-    if (s.lifetime > 0) next_state.push_back(s);
-  }
-  particles = next_state;
+  for (ParticlePool* p : pools) p->Simulate(secs);
 }
 
 void Particles::DeleteAll() {
-  for (State& s : particles) {
-    delete s.sprite;
-  }
-  particles.clear();
+  for (ParticlePool* p : pools) p->Clear();
 }
 
 unsigned MainMenu::program = 0;
@@ -553,62 +672,67 @@ void MainMenu::OnUpDownPressed(int delta) {
 }
 
 // Layout
-void MainMenu::EnterMenu(const MenuKind idx, bool is_from_exit) {
-  printf("EnterMenu(%d, %d)\n", idx, is_from_exit);
-  menutitle.clear();
-  menuitems.clear();
+void MainMenu::BuildMenu(const MenuKind idx, std::vector<std::wstring>* titles, std::vector<MenuItem>* items) {
   const wchar_t* title0 = L"C Y Climb",
                * title1 = L"2019--2025";
 
   switch (idx) {
     case MenuKind::MAIN: {
-      menutitle.push_back(title0);
-      menutitle.push_back(title1);
-      menutitle.push_back(L"Main Menu");
-
-      menuitems.push_back(MenuItem(L"Start Game"));
-      menuitems.push_back(MenuItem(L"Level Select"));
-      menuitems.push_back(MenuItem(L"Edit Mode"));
-      menuitems.push_back(MenuItem(L"Options"));
-      menuitems.push_back(MenuItem(L"Help"));
-      menuitems.push_back(MenuItem(L"Exit"));
+      titles->push_back(title0);
+      titles->push_back(title1);
+      titles->push_back(L"Main Menu");
+
+      items->push_back(MenuItem(L"Start Game"));
+      items->push_back(MenuItem(L"Level Select"));
+      items->push_back(MenuItem(L"Edit Mode"));
+      items->push_back(MenuItem(L"Options"));
+      items->push_back(MenuItem(L"Help"));
+      items->push_back(MenuItem(L"Exit"));
       break;
     }
     case MenuKind::HELP: {  // Edit mode
-      menutitle.push_back(title0);
-      menutitle.push_back(title1);
-      menutitle.push_back(L"Main Menu");
-      FadeInHelpScreen();
-      menuitems.push_back(MenuItem(L" "));
+      titles->push_back(title0);
+      titles->push_back(title1);
+      titles->push_back(L"Main Menu");
+      items->push_back(MenuItem(L" "));
       break;
     }
     case MenuKind::OPTIONS: {  // Options
-      menutitle.push_back(title0);
-      menutitle.push_back(title1);
+      titles->push_back(title0);
+      titles->push_back(title1);
 
-      menuitems.push_back(GetMenuItem("antialias"));
-      menuitems.push_back(GetMenuItem("shadows"));
+      items->push_back(GetMenuItem("antialias"));
+      items->push_back(GetMenuItem("shadows"));
       break;
     }
     case MenuKind::EDIT_MODE: {
-      menutitle.push_back(L"[Edit Mode Menu]");
-      menuitems.push_back(MenuItem(L"Test Play"));
-      menuitems.push_back(MenuItem(L"Return to Editing"));
-      menuitems.push_back(MenuItem(L"Exit Edit Mode"));
+      titles->push_back(L"[Edit Mode Menu]");
+      items->push_back(MenuItem(L"Test Play"));
+      items->push_back(MenuItem(L"Return to Editing"));
+      items->push_back(MenuItem(L"Exit Edit Mode"));
       break;
     }
     case MenuKind::LEVEL_SELECT: {
-      menutitle.push_back(L"[Level Select]");
-      for (int i = 0; i < static_cast<int>(g_climbscene->levels.size()); i++) {
+      titles->push_back(L"[Level Select]");
+      const int num_levels = g_climbscene ? static_cast<int>(g_climbscene->levels.size()) : 0;
+      for (int i = 0; i < num_levels; i++) {
         std::wstring x = L"Level " + std::to_wstring(i + 1);
-        menuitems.push_back(MenuItem(x.c_str()));
+        items->push_back(MenuItem(x.c_str()));
       }
-      menuitems.push_back(MenuItem(L"Back"));
+      items->push_back(MenuItem(L"Back"));
       break;
     }
     default:
       break;
   }
+}
+
+void MainMenu::EnterMenu(const MenuKind idx, bool is_from_exit) {
+  printf("EnterMenu(%d, %d)\n", idx, is_from_exit);
+  menutitle.clear();
+  menuitems.clear();
+  BuildMenu(idx, &menutitle, &menuitems);
+  if (idx == MenuKind::HELP) FadeInHelpScreen();
   if (!is_from_exit || curr_menu.empty()) {
     curr_menu.push_back(idx);
     curr_selection.push_back(0);
@@ -638,8 +762,10 @@ void MainMenu::OnEnter() {
       case 4: EnterMenu(MenuKind::HELP, false); break; // Help
       case 5: {
         // close glfw window
-        glfwSetWindowShouldClose(g_window, true); 
-        glfwDestroyWindow(g_window);
+        #ifndef CYCLIMB_HEADLESS
+          glfwSetWindowShouldClose(g_window, true); 
+          glfwDestroyWindow(g_window);
+        #endif
         // close D3D window
         #ifdef WIN32
           DestroyWindow(g_hwnd);
@@ -851,4 +977,35 @@ void TextMessage::Render(GraphicsAPI api) {
   }
 }
 
+// 所有菜单的字加上可打印的 ASCII（关卡编号等）
+void MainMenu::PrewarmGlyphs() {
+  std::wstring text;
+  for (wchar_t ch = 0x20; ch < 0x7F; ch++) text.push_back(ch);
+  const MenuKind kinds[] = { MenuKind::MAIN, MenuKind::HELP, MenuKind::OPTIONS, MenuKind::EDIT_MODE, MenuKind::LEVEL_SELECT };
+  for (const MenuKind k : kinds) {
+    std::vector<std::wstring> titles;
+    std::vector<MenuItem> items;
+    BuildMenu(k, &titles, &items);
+    for (const std::wstring& t : titles) text += t;
+    for (const MenuItem& item : items) {
+      text += item.text;
+      for (const std::wstring& c : item.choices) text += c;
+    }
+  }
+  PrewarmText(text);
+}
+
+void TextMessage::SetMessage(const std::wstring& _msg, float seconds) {
+  unsigned elapsed = GetElapsedMillis();
+  millis_expire = (elapsed + seconds * 1000);
+  messages.clear();
+  messages.push_back(_msg);
+  PrewarmText(_msg);
+}
+
+void TextMessage::AppendLine(const std::wstring& _msg) {
+  messages.push_back(_msg);
+  PrewarmText(_msg);
+}
+
 unsigned TextMessage::program = 0;
\ No newline at end of file
@@ -10,7 +10,9 @@
 #include "util.hpp"
 #include "camera.hpp"
 
+#ifndef CYCLIMB_HEADLESS
 #include <GLFW/glfw3.h>
+#endif
 
 #include <vector>
 #include <string>
@@ -22,21 +24,62 @@ extern ID3D11ShaderResourceView* g_helpinfo_srv11;
 #undef min
 
 
-//
+// 同一个模型的所有粒子。整池在渲染列表里只占一项，画的时候一次实例化绘制。
+// 有 CPU 的（下面）和 GPU 的（gpuparticles.hpp）两种实现。
+class ParticlePool : public Sprite {
+public:
+  ParticlePool(ChunkIndex* _mesh);
+  ChunkIndex* mesh;
+  int count;  // 要画的实例数
+  virtual bool Add(const glm::vec3& p, const glm::vec3& v, float _lifetime) = 0; // 满了返回 false
+  virtual void Simulate(float secs) = 0;
+  virtual void Clear() = 0;
+  virtual bool IntersectPoint(const glm::vec3& p_world) { return false; }
+  virtual bool IntersectPoint(const glm::vec3& p_world, int tolerance) { return false; }
+};
+
+// 容量固定，各分量分开存（SoA），Simulate 用 SIMD 内核（particlekernel.hpp），
+// 死掉的粒子和最后一个交换后去掉。每次模拟完整个传一遍位置。
+class CpuParticlePool : public ParticlePool {
+public:
+  static const int CAPACITY = 65536;
+  CpuParticlePool(ChunkIndex* _mesh);
+  std::vector<float> pos_x, pos_y, pos_z;
+  std::vector<float> vel_x, vel_y, vel_z;
+  std::vector<float> lifetime, inv_lifetime_full;
+  virtual bool Add(const glm::vec3& p, const glm::vec3& v, float _lifetime);
+  virtual void Simulate(float secs);
+  virtual void Clear() { count = 0; }
+
+  virtual void Render();
+#ifdef WIN32
+  virtual void Render_D3D11();
+  virtual void RecordRenderCommand_D3D12(
+    ChunkPass* chunk_pass,
+    const DirectX::XMMATRIX& V,
+    const DirectX::XMMATRIX& P);
+#endif
+private:
+  bool instances_dirty;   // 位置变了，还没传给 GPU
+  GLuint instance_vbo;
+#ifdef WIN32
+  ID3D11Buffer* instance_buffer11;
+#endif
+};
+
 class Particles {
 public:
   Particles();
   void SpawnDefaultSprite(const glm::vec3& pos, float lifetime, float v0);
   void Spawn(ChunkIndex* src, const glm::vec3& pos, float lifetime, float v0);
-  struct State {
-    ChunkSprite* sprite;
-    float lifetime, lifetime_full;
-  };
-  std::vector<State> particles;
+  std::vector<ParticlePool*> pools;  // 每种模型一个
   void Update(float secs);
   static void InitStatic(ChunkIndex* x);
   static ChunkIndex* default_particle;
   void DeleteAll();
+private:
+  unsigned rng;  // xorshift
+  float Random01();
 };
 
 class MainMenu {
@@ -107,6 +150,8 @@ public:
   void OnEscPressed();
   void OnEnter();
   void EnterMenu(const MenuKind idx, bool is_from_exit);
+  void BuildMenu(const MenuKind idx, std::vector<std::wstring>* titles, std::vector<MenuItem>* items);
+  void PrewarmGlyphs();  // 菜单里的字提前光栅化
   void ExitMenu();
   bool IsInHelp() { return is_in_help; }
   void DrawHelpScreen();
@@ -147,15 +192,8 @@ public:
   std::vector<std::wstring> messages;
   unsigned millis_expire;
   TextMessage() { millis_expire = 0; }
-  void SetMessage(const std::wstring& _msg, float seconds) {
-    unsigned elapsed = GetElapsedMillis();
-    millis_expire = (elapsed + seconds * 1000);
-    messages.clear();
-    messages.push_back(_msg);
-  }
-  void AppendLine(const std::wstring& _msg) {
-    messages.push_back(_msg);
-  }
+  void SetMessage(const std::wstring& _msg, float seconds);
+  void AppendLine(const std::wstring& _msg);
   bool IsExpired() {
     int x = int(GetElapsedMillis());
     return x >= millis_expire;
@@ -0,0 +1,229 @@
+#include "gpuparticles.hpp"
+#include "shader.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
+
+#ifdef WIN32
+#include <d3dcompiler.h>
+extern ID3D11Device* g_device11;
+extern ID3D11DeviceContext* g_context11;
+extern ID3D11VertexShader* g_vs_default_palette;
+extern ID3D11VertexShader* g_vs_default_palette_instanced;
+extern ID3D11InputLayout* g_inputlayout_voxel11;
+extern ID3D11InputLayout* g_inputlayout_voxel_instanced11;
+extern void CE(HRESULT x, ID3DBlob* error);
+#endif
+
+extern bool IsGL();
+extern bool IsD3D11();
+
+bool g_gpu_particles = false;
+
+unsigned GpuParticlePool::update_program = 0;
+#ifdef WIN32
+ID3D11ComputeShader* GpuParticlePool::cs_update11 = nullptr;
+ID3D11Buffer* GpuParticlePool::update_cb11 = nullptr;
+
+struct ParticleUpdateCB {
+  float secs, k;
+  unsigned count;
+  float pad;
+};
+#endif
+
+bool GpuParticlePool::IsSupported() {
+  if (IsGL()) return GLEW_VERSION_3_3 != 0;
+#ifdef WIN32
+  if (IsD3D11()) return g_device11->GetFeatureLevel() >= D3D_FEATURE_LEVEL_11_0;
+#endif
+  return false;
+}
+
+GpuParticlePool::GpuParticlePool(ChunkIndex* _mesh) : ParticlePool(_mesh),
+  cursor(0), max_life_left(0), src(0) {
+  buffers[0] = buffers[1] = 0;
+  vaos[0] = vaos[1] = 0;
+#ifdef WIN32
+  buffer11 = nullptr;
+  uav11 = nullptr;
+#endif
+  pending.reserve(1024);
+}
+
+void GpuParticlePool::InitGL() {
+  if (update_program == 0) {
+    const char* varyings[] = { "out_pos", "out_vel", "out_lifetime", "out_inv_lifetime_full" };
+    update_program = CreateTransformFeedbackProgram("shaders/particles_update.vs", varyings, 4);
+  }
+  glGenBuffers(2, buffers);
+  glGenVertexArrays(2, vaos);
+  const GLsizei stride = sizeof(Particle);
+  for (int i = 0; i < 2; i++) {
+    glBindVertexArray(vaos[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+    glBufferData(GL_ARRAY_BUFFER, stride * CAPACITY, nullptr, GL_DYNAMIC_COPY);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(offsetof(Particle, pos)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(offsetof(Particle, vel)));
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(offsetof(Particle, lifetime)));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(offsetof(Particle, inv_lifetime_full)));
+    for (int j = 0; j < 4; j++) glEnableVertexAttribArray(j);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  MyCheckGLError("GpuParticlePool::InitGL");
+}
+
+#ifdef WIN32
+void GpuParticlePool::InitD3D11() {
+  if (cs_update11 == nullptr) {
+    ID3DBlob *blob = nullptr, *error = nullptr;
+    CE(D3DCompileFromFile(L"shaders_hlsl/particles_update.hlsl", nullptr, nullptr, "CSMain", "cs_5_0", 0, 0, &blob, &error), error);
+    assert(SUCCEEDED(g_device11->CreateComputeShader(blob->GetBufferPointer(), blob->GetBufferSize(), nullptr, &cs_update11)));
+    blob->Release();
+
+    D3D11_BUFFER_DESC desc = { };
+    desc.ByteWidth = sizeof(ParticleUpdateCB);
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    assert(SUCCEEDED(g_device11->CreateBuffer(&desc, nullptr, &update_cb11)));
+  }
+
+  // 既当顶点缓冲又当 UAV，计算着色器按字节地址读写
+  D3D11_BUFFER_DESC desc = { };
+  desc.ByteWidth = sizeof(Particle) * CAPACITY;
+  desc.Usage = D3D11_USAGE_DEFAULT;
+  desc.BindFlags = D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_UNORDERED_ACCESS;
+  desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+  assert(SUCCEEDED(g_device11->CreateBuffer(&desc, nullptr, &buffer11)));
+
+  D3D11_UNORDERED_ACCESS_VIEW_DESC uavd = { };
+  uavd.Format = DXGI_FORMAT_R32_TYPELESS;
+  uavd.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+  uavd.Buffer.NumElements = desc.ByteWidth / 4;
+  uavd.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+  assert(SUCCEEDED(g_device11->CreateUnorderedAccessView(buffer11, &uavd, &uav11)));
+}
+#endif
+
+bool GpuParticlePool::Add(const glm::vec3& p, const glm::vec3& v, float _lifetime) {
+  if (_lifetime <= 0) return false;
+  Particle x = { { p.x, p.y, p.z }, { v.x, v.y, v.z }, _lifetime, 1.0f / _lifetime };
+  pending.push_back(x);
+  if (_lifetime > max_life_left) max_life_left = _lifetime;
+  return true;
+}
+
+void GpuParticlePool::Clear() {
+  pending.clear();
+  count = 0;
+  cursor = 0;
+  max_life_left = 0;
+}
+
+void GpuParticlePool::Upload(int slot, const Particle* data, int n) {
+  if (IsGL()) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[src]);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(Particle) * slot, sizeof(Particle) * n, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    D3D11_BOX box = { UINT(sizeof(Particle) * slot), 0, 0, UINT(sizeof(Particle) * (slot + n)), 1, 1 };
+    g_context11->UpdateSubresource(buffer11, 0, &box, data, 0, 0);
+  }
+#endif
+}
+
+// 新粒子写到环里，绕回来的时候分两段
+void GpuParticlePool::FlushPending() {
+  if (pending.empty()) return;
+  if (IsGL() && buffers[0] == 0) InitGL();
+#ifdef WIN32
+  if (IsD3D11() && buffer11 == nullptr) InitD3D11();
+#endif
+  const Particle* data = pending.data();
+  int n = int(pending.size());
+  if (n > CAPACITY) {  // 一次来太多，只留最后的
+    data += n - CAPACITY;
+    n = CAPACITY;
+  }
+  while (n > 0) {
+    const int m = std::min(n, CAPACITY - cursor);
+    Upload(cursor, data, m);
+    cursor += m;
+    if (cursor > count) count = cursor;
+    if (cursor == CAPACITY) cursor = 0;
+    data += m;
+    n -= m;
+  }
+  pending.clear();
+}
+
+void GpuParticlePool::Simulate(float secs) {
+  FlushPending();
+  if (count == 0) return;
+  max_life_left -= secs;
+  if (max_life_left <= 0) {  // 全死了
+    Clear();
+    return;
+  }
+  const float k = secs * SIM_REF_FPS;
+
+  if (IsGL()) {
+    glUseProgram(update_program);
+    glUniform1f(glGetUniformLocation(update_program, "secs"), secs);
+    glUniform1f(glGetUniformLocation(update_program, "k"), k);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(vaos[src]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1 - src]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, count);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glUseProgram(0);
+    src = 1 - src;
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    assert(SUCCEEDED(g_context11->Map(update_cb11, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)));
+    ParticleUpdateCB cb = { secs, k, unsigned(count), 0 };
+    memcpy(mapped.pData, &cb, sizeof(cb));
+    g_context11->Unmap(update_cb11, 0);
+
+    ID3D11UnorderedAccessView* null_uav = nullptr;
+    g_context11->CSSetShader(cs_update11, nullptr, 0);
+    g_context11->CSSetConstantBuffers(0, 1, &update_cb11);
+    g_context11->CSSetUnorderedAccessViews(0, 1, &uav11, nullptr);
+    g_context11->Dispatch((count + 63) / 64, 1, 1);
+    // 下面要当顶点缓冲用
+    g_context11->CSSetUnorderedAccessViews(0, 1, &null_uav, nullptr);
+    g_context11->CSSetShader(nullptr, nullptr, 0);
+  }
+#endif
+}
+
+void GpuParticlePool::Render() {
+  FlushPending();
+  if (count == 0) return;
+  const InstanceLayout layout = { sizeof(Particle), { 0, sizeof(float), sizeof(float) * 2 } };
+  mesh->RenderInstanced(scale, orientation, anchor, buffers[src], layout, count);
+}
+
+#ifdef WIN32
+void GpuParticlePool::Render_D3D11() {
+  FlushPending();
+  if (count == 0) return;
+  const InstanceLayout layout = { sizeof(Particle), { 0, sizeof(float), sizeof(float) * 2 } };
+  g_context11->VSSetShader(g_vs_default_palette_instanced, nullptr, 0);
+  g_context11->IASetInputLayout(g_inputlayout_voxel_instanced11);
+  mesh->RenderInstanced_D3D11(scale, orientation, anchor, buffer11, layout, count);
+  g_context11->VSSetShader(g_vs_default_palette, nullptr, 0);
+  g_context11->IASetInputLayout(g_inputlayout_voxel11);
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef _GPUPARTICLES_HPP
+#define _GPUPARTICLES_HPP
+
+#include "game.hpp"
+#ifdef WIN32
+#include <d3d11.h>
+#endif
+
+extern bool g_gpu_particles; // cyclimb gpuparticles
+
+// 粒子状态整个放在 GPU 上，CPU 只负责把新生成的粒子传上去。
+// GL 用顶点着色器 + transform feedback 在两个缓冲之间来回倒；D3D11 用计算着色器原地更新。
+// D3D12 没有实现，Particles::Spawn 会退回 CpuParticlePool。
+//
+// 槽位按环形分配，满了就覆盖最老的。不在 CPU 上删粒子：死掉的粒子被着色器挪到很远的地方，
+// count 是用过的最大槽位数，CPU 按最长的剩余寿命算出全部死光时再归零。
+// 所以 CPU 每帧的开销和活着的粒子数无关。
+class GpuParticlePool : public ParticlePool {
+public:
+  static const int CAPACITY = 262144;
+  struct Particle {  // 和 particles_update.vs/.hlsl 里的布局一致
+    float pos[3];
+    float vel[3];
+    float lifetime, inv_lifetime_full;
+  };
+  static bool IsSupported();
+
+  GpuParticlePool(ChunkIndex* _mesh);
+  virtual bool Add(const glm::vec3& p, const glm::vec3& v, float _lifetime);
+  virtual void Simulate(float secs);
+  virtual void Clear();
+
+  virtual void Render();
+#ifdef WIN32
+  virtual void Render_D3D11();
+  virtual void RecordRenderCommand_D3D12(
+    ChunkPass* chunk_pass,
+    const DirectX::XMMATRIX& V,
+    const DirectX::XMMATRIX& P) { }
+#endif
+private:
+  std::vector<Particle> pending;  // 还没传上去的
+  int cursor;                     // 下一个要写的槽位
+  float max_life_left;
+  void FlushPending();
+  void Upload(int slot, const Particle* src, int n);
+
+  // GL
+  static unsigned update_program;
+  GLuint buffers[2], vaos[2];
+  int src;  // 当前数据在 buffers[src]
+#ifdef WIN32
+  // D3D11
+  static ID3D11ComputeShader* cs_update11;
+  static ID3D11Buffer* update_cb11;
+  ID3D11Buffer* buffer11;
+  ID3D11UnorderedAccessView* uav11;
+#endif
+  void InitGL();
+#ifdef WIN32
+  void InitD3D11();
+#endif
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "gputimer.hpp"
+#include "profiler.hpp"
+#include <stdio.h>
+
+#ifdef WIN32
+#include "d3dx12.h"
+extern ID3D11Device* g_device11;
+extern ID3D11DeviceContext* g_context11;
+extern ID3D12Device* g_device12;
+extern ID3D12CommandQueue* g_command_queue;
+extern ID3D12GraphicsCommandList* g_command_list;
+#endif
+
+extern bool IsGL();
+extern bool IsD3D11();
+extern bool IsD3D12();
+
+bool GpuTimer::active = false;
+bool GpuTimer::always_on = false;
+bool GpuTimer::inited = false;
+bool GpuTimer::supported = false;
+int  GpuTimer::frame_idx = 0;
+int  GpuTimer::curr_pass = -1;
+const char* GpuTimer::names[GpuTimer::NUM_FRAMES][GpuTimer::MAX_PASSES];
+int  GpuTimer::num_passes[GpuTimer::NUM_FRAMES];
+bool GpuTimer::pending[GpuTimer::NUM_FRAMES];
+int   GpuTimer::scaled_pass[GpuTimer::NUM_FRAMES];
+float GpuTimer::pass_scale[GpuTimer::NUM_FRAMES];
+bool  GpuTimer::has_sample = false;
+float GpuTimer::sample_ms, GpuTimer::sample_scale;
+GLuint GpuTimer::gl_queries[GpuTimer::NUM_FRAMES][GpuTimer::MAX_PASSES];
+#ifdef WIN32
+ID3D11Query* GpuTimer::d3d11_disjoint[GpuTimer::NUM_FRAMES];
+ID3D11Query* GpuTimer::d3d11_timestamps[GpuTimer::NUM_FRAMES][GpuTimer::MAX_PASSES][2];
+ID3D12QueryHeap* GpuTimer::d3d12_query_heap;
+ID3D12Resource*  GpuTimer::d3d12_readback;
+UINT64 GpuTimer::d3d12_frequency;
+#endif
+
+void GpuTimer::Init() {
+  inited = true;
+  if (IsGL()) {
+    if (!GLEW_VERSION_3_3 && !GLEW_ARB_timer_query) {
+      printf("GL_ARB_timer_query not supported, no GPU timings\n");
+      return;
+    }
+    glGenQueries(NUM_FRAMES * MAX_PASSES, &gl_queries[0][0]);
+    MyCheckGLError("GpuTimer::Init");
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    D3D11_QUERY_DESC desc = {};
+    desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+    for (int f = 0; f < NUM_FRAMES; f++) {
+      CE(g_device11->CreateQuery(&desc, &d3d11_disjoint[f]));
+    }
+    desc.Query = D3D11_QUERY_TIMESTAMP;
+    for (int f = 0; f < NUM_FRAMES; f++) {
+      for (int p = 0; p < MAX_PASSES; p++) {
+        CE(g_device11->CreateQuery(&desc, &d3d11_timestamps[f][p][0]));
+        CE(g_device11->CreateQuery(&desc, &d3d11_timestamps[f][p][1]));
+      }
+    }
+  }
+  else if (IsD3D12()) {
+    D3D12_QUERY_HEAP_DESC desc = {};
+    desc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    desc.Count = NUM_FRAMES * MAX_PASSES * 2;
+    CE(g_device12->CreateQueryHeap(&desc, IID_PPV_ARGS(&d3d12_query_heap)));
+    CE(g_device12->CreateCommittedResource(
+      &keep(CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK)),
+      D3D12_HEAP_FLAG_NONE,
+      &keep(CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT64) * desc.Count)),
+      D3D12_RESOURCE_STATE_COPY_DEST,
+      nullptr,
+      IID_PPV_ARGS(&d3d12_readback)));
+    CE(g_command_queue->GetTimestampFrequency(&d3d12_frequency));
+  }
+#endif
+  supported = true;
+}
+
+// 读回 NUM_FRAMES 帧之前发出的查询；没好就不要了
+void GpuTimer::CollectResults(int slot) {
+  if (!pending[slot]) return;
+  pending[slot] = false;
+  const int n = num_passes[slot];
+  if (n == 0) return;
+  float scaled_ms = 0;
+
+  if (IsGL()) {
+    // 查询按顺序完成，看最后一个就行
+    GLint available = 0;
+    glGetQueryObjectiv(gl_queries[slot][n - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return;
+    for (int i = 0; i < n; i++) {
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(gl_queries[slot][i], GL_QUERY_RESULT, &ns);
+      if (Profiler::enabled) Profiler::AddSample(names[slot][i], ns * 1e-6f, true);
+      if (i == scaled_pass[slot]) scaled_ms = ns * 1e-6f;
+    }
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    const UINT flags = D3D11_ASYNC_GETDATA_DONOTFLUSH;
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+    if (g_context11->GetData(d3d11_disjoint[slot], &disjoint, sizeof(disjoint), flags) != S_OK) return;
+    if (disjoint.Disjoint) return;
+    for (int i = 0; i < n; i++) {
+      UINT64 t0, t1;
+      if (g_context11->GetData(d3d11_timestamps[slot][i][0], &t0, sizeof(t0), flags) != S_OK) return;
+      if (g_context11->GetData(d3d11_timestamps[slot][i][1], &t1, sizeof(t1), flags) != S_OK) return;
+      const float ms = float((t1 - t0) * 1000.0 / disjoint.Frequency);
+      if (Profiler::enabled) Profiler::AddSample(names[slot][i], ms, true);
+      if (i == scaled_pass[slot]) scaled_ms = ms;
+    }
+  }
+  else if (IsD3D12()) {
+    const int base = slot * MAX_PASSES * 2;
+    D3D12_RANGE read_range = { sizeof(UINT64) * base, sizeof(UINT64) * (base + n * 2) };
+    UINT64* data = nullptr;
+    CE(d3d12_readback->Map(0, &read_range, (void**)&data));
+    for (int i = 0; i < n; i++) {
+      const UINT64 t0 = data[base + i * 2], t1 = data[base + i * 2 + 1];
+      const float ms = float((t1 - t0) * 1000.0 / d3d12_frequency);
+      if (Profiler::enabled) Profiler::AddSample(names[slot][i], ms, true);
+      if (i == scaled_pass[slot]) scaled_ms = ms;
+    }
+    D3D12_RANGE write_range = { 0, 0 };
+    d3d12_readback->Unmap(0, &write_range);
+  }
+#endif
+  if (scaled_pass[slot] != -1) {
+    has_sample = true;
+    sample_ms = scaled_ms;
+    sample_scale = pass_scale[slot];
+  }
+}
+
+bool GpuTimer::TakeScaledSample(float* ms, float* scale) {
+  if (!has_sample) return false;
+  has_sample = false;
+  *ms = sample_ms;
+  *scale = sample_scale;
+  return true;
+}
+
+void GpuTimer::BeginFrame() {
+  active = Profiler::enabled || always_on;
+  if (!active) return;
+  if (!inited) Init();
+  if (!supported) {
+    active = false;
+    return;
+  }
+
+  const int slot = frame_idx % NUM_FRAMES;
+  CollectResults(slot);
+  num_passes[slot] = 0;
+  scaled_pass[slot] = -1;
+  curr_pass = -1;
+#ifdef WIN32
+  if (IsD3D11()) {
+    g_context11->Begin(d3d11_disjoint[slot]);
+  }
+#endif
+}
+
+void GpuTimer::BeginPass(const char* name, float scale) {
+  if (!active) return;
+  const int slot = frame_idx % NUM_FRAMES;
+  const int n = num_passes[slot];
+  if (n >= MAX_PASSES || curr_pass != -1) return;
+  curr_pass = n;
+  names[slot][n] = name;
+  if (scale > 0) {
+    scaled_pass[slot] = n;
+    pass_scale[slot] = scale;
+  }
+  if (IsGL()) {
+    glBeginQuery(GL_TIME_ELAPSED, gl_queries[slot][n]);
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    g_context11->End(d3d11_timestamps[slot][n][0]);
+  }
+  else if (IsD3D12()) {
+    g_command_list->EndQuery(d3d12_query_heap, D3D12_QUERY_TYPE_TIMESTAMP, (slot * MAX_PASSES + n) * 2);
+  }
+#endif
+}
+
+void GpuTimer::EndPass() {
+  if (!active || curr_pass == -1) return;
+  const int slot = frame_idx % NUM_FRAMES;
+  const int n = curr_pass;
+  if (IsGL()) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+#ifdef WIN32
+  else if (IsD3D11()) {
+    g_context11->End(d3d11_timestamps[slot][n][1]);
+  }
+  else if (IsD3D12()) {
+    g_command_list->EndQuery(d3d12_query_heap, D3D12_QUERY_TYPE_TIMESTAMP, (slot * MAX_PASSES + n) * 2 + 1);
+  }
+#endif
+  num_passes[slot] = n + 1;
+  curr_pass = -1;
+}
+
+void GpuTimer::EndFrame() {
+  if (!active) return;
+  const int slot = frame_idx % NUM_FRAMES;
+#ifdef WIN32
+  if (IsD3D11()) {
+    g_context11->End(d3d11_disjoint[slot]);
+  }
+  else if (IsD3D12() && num_passes[slot] > 0) {
+    const int base = slot * MAX_PASSES * 2;
+    g_command_list->ResolveQueryData(d3d12_query_heap, D3D12_QUERY_TYPE_TIMESTAMP,
+      base, num_passes[slot] * 2, d3d12_readback, sizeof(UINT64) * base);
+  }
+#endif
+  pending[slot] = true;
+  frame_idx++;
+}
@@ -0,0 +1,65 @@
+#ifndef _GPUTIMER_HPP
+#define _GPUTIMER_HPP
+
+#include "util.hpp"
+#ifdef WIN32
+#include <d3d11.h>
+#include <d3d12.h>
+#endif
+
+// 每个 Pass 的 GPU 耗时。
+// GL 用 GL_TIME_ELAPSED，D3D11/12 用时间戳。查询结果隔 NUM_FRAMES 帧再读，
+// 还没好就丢掉这一帧的数据，所以永远不会等 GPU。
+// 结果和 CPU 计时一起送到 Profiler 的统计里（is_gpu = true）。
+//
+//   GpuTimer::BeginFrame();
+//   GpuTimer::BeginPass("depth pass"); ... GpuTimer::EndPass();
+//   GpuTimer::EndFrame();
+//
+// Pass 不能嵌套（GL_TIME_ELAPSED 同时只能有一个）。
+// D3D12 下 BeginPass/EndPass/EndFrame 要在命令列表打开时调用。
+class GpuTimer {
+public:
+  static const int MAX_PASSES = 8;
+  static const int NUM_FRAMES = 2;
+
+  static bool  always_on;      // Profiler 没开也计时，动态分辨率要用
+
+  static void BeginFrame();
+  static void EndFrame();
+  // scale > 0：这个 Pass 是按这个渲染比例画的（每帧最多一个），动态分辨率拿它的耗时
+  static void BeginPass(const char* name, float scale = 0);
+  static void EndPass();
+  // 新读回的带 scale 的 Pass 的耗时和当时的 scale；每个结果只交出一次，没有新的返回 false
+  static bool TakeScaledSample(float* ms, float* scale);
+
+private:
+  static bool active;      // 本帧是否在计时
+  static bool inited, supported;
+  static int  frame_idx;   // 一直增加
+  static int  curr_pass;
+  static const char* names[NUM_FRAMES][MAX_PASSES];
+  static int  num_passes[NUM_FRAMES];
+  static bool pending[NUM_FRAMES];
+  static int   scaled_pass[NUM_FRAMES];   // 没有为 -1
+  static float pass_scale[NUM_FRAMES];
+  static bool  has_sample;
+  static float sample_ms, sample_scale;
+
+  static void Init();
+  static void CollectResults(int slot);
+
+  // GL
+  static GLuint gl_queries[NUM_FRAMES][MAX_PASSES];
+#ifdef WIN32
+  // D3D11
+  static ID3D11Query* d3d11_disjoint[NUM_FRAMES];
+  static ID3D11Query* d3d11_timestamps[NUM_FRAMES][MAX_PASSES][2];
+  // D3D12
+  static ID3D12QueryHeap* d3d12_query_heap;
+  static ID3D12Resource*  d3d12_readback;
+  static UINT64 d3d12_frequency;
+#endif
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _HEADLESS_GL_HPP
+#define _HEADLESS_GL_HPP
+
+// 无头版本（-DCYCLIMB_HEADLESS）不链接 GL/GLEW/GLFW，只要头文件里用到的这几个类型。
+// 真正调用 GL 的地方都用 #ifndef CYCLIMB_HEADLESS 包起来了
+typedef unsigned int   GLuint;
+typedef int            GLint;
+typedef unsigned int   GLenum;
+typedef float          GLfloat;
+typedef int            GLsizei;
+typedef unsigned char  GLboolean;
+typedef void           GLvoid;
+
+typedef struct GLFWwindow GLFWwindow;
+
+#endif
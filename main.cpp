@@ -12,6 +12,9 @@
 #include "textrender.hpp"
 #include "scene.hpp"
 #include "sounds.hpp"
+#include "profiler.hpp"
+#include "gputimer.hpp"
+#include "gpuparticles.hpp"
 
 #include <bitset>
 #include <stdlib.h>
@@ -22,7 +25,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#ifndef CYCLIMB_HEADLESS
 #include <GLFW/glfw3.h>
+#endif
 
 #ifdef WIN32
 #pragma comment(linker, "/SUBSYSTEM:windows /ENTRY:mainCRTStartup")
@@ -54,6 +59,15 @@ GLuint GetShaderProgram(int idx) {
 
 Camera g_cam;
 unsigned g_last_millis = 0;
+
+// 固定步长模拟：update() 把实际经过的时间攒进 g_sim_accum，再按 SIM_DT 一步步推进；
+// 剩下不足一步的部分用于渲染时在前后两步之间插值
+const float SIM_DT = 1.0f / 120.0f;
+const float SIM_MAX_FRAME_SECS = 0.25f; // 卡顿时最多追这么多，防止越追越慢
+float  g_sim_accum = 0.0f;
+float  g_sim_alpha = 1.0f;
+double g_sim_secs = 0.0;
+unsigned GetSimulationMillis() { return unsigned(g_sim_secs * 1000.0); }
 char g_cam_dx = 0,   g_cam_dy = 0,   g_cam_dz = 0,  // CONTROL axes, not OpenGL axes
      g_arrow_dx = 0, g_arrow_dy = 0, g_arrow_dz = 0;
 std::bitset<18> g_cam_flags;
@@ -109,7 +123,8 @@ Camera* GetCurrentSceneCamera() {
 // Follow this tutorial: https://learnopengl.com/Advanced-OpenGL/Anti-Aliasing
 MsaaFBO* g_msaa_fbo, *g_slateui_msaa_fbo;
 BasicFBO* g_basic_fbo, *g_slateui_basic_fbo;
-DepthOnlyFBO* g_depth_fbo;
+DepthOnlyFBO* g_depth_fbo;         // 每帧重画的动态投影物
+DepthOnlyFBO* g_static_depth_fbo;  // 缓存的静态投影物，见 UpdateStaticShadowMap
 FullScreenQuad* g_fullscreen_quad;
 DirectionalLight* g_dir_light;
 DirectionalLight* g_dir_light1;
@@ -122,12 +137,36 @@ float g_cam_rot_x = 0.0f, g_cam_rot_y = 0.0f;
 
 int g_ctrl_spr_idx = 0;
 bool g_aa = true, g_shadows = true;
+bool g_ui_layer_dirty = true; // g_slateui_basic_fbo 里的 UI 要重画（比如 FBO 重建了）
+bool g_depth_prepass = false; // cyclimb prepass
+bool g_fit_shadow = true;  // 阴影的投影跟着相机收紧，见 DirectionalLight::FitToFrustum
+bool g_voxel_lod = true;   // 远景按屏幕大小用粗的网格，见 ChunkGrid::EnableLOD
+// 动态分辨率：场景画在 g_render_scale 倍大小的视口里再拉伸到窗口，UI 一直是原始分辨率
+bool g_dynamic_res = false;  // cyclimb dynres
+float g_render_scale = 1.0f;
+// 只是按比例画的那一段（主场景）的预算；阴影、UI、合成的时间和分辨率无关，留在剩下的里面
+const float SCENE_GPU_BUDGET_MS = 10.0f, MIN_RENDER_SCALE = 0.5f;
 
 unsigned g_test_tri_vao;
 unsigned g_test_quad_vao;
 
 int g_mouse_x = 0, g_mouse_y = 0;
 
+// 下面是窗口、GL 初始化和渲染，无头版本（CYCLIMB_HEADLESS）不编译
+#ifndef CYCLIMB_HEADLESS
+// 和窗口一样大的几个 FBO；窗口大小变了要重建
+void CreateScreenTargets() {
+  delete g_msaa_fbo;
+  delete g_slateui_msaa_fbo;
+  delete g_basic_fbo;
+  delete g_slateui_basic_fbo;
+  g_msaa_fbo  = new MsaaFBO(WIN_W, WIN_H, 4);
+  g_slateui_msaa_fbo = new MsaaFBO(WIN_W, WIN_H, 4);
+  g_basic_fbo = new BasicFBO(WIN_W, WIN_H);
+  g_slateui_basic_fbo = new BasicFBO(WIN_W, WIN_H);
+  g_ui_layer_dirty = true;
+}
+
 void MyInit() {
   {
     float vertices[] = {
@@ -193,16 +232,15 @@ void MyInit() {
   g_dir_light1 = new DirectionalLight(dir, glm::vec3(0, 50, 0), glm::normalize(glm::cross(glm::vec3(0, 0, 1), dir)), 5.05 * 3.14159f / 180.0f);
   //g_dir_light1 = new DirectionalLight(glm::vec3(1, -3, -1), glm::vec3(-50, 10, 10), glm::vec3(1, 0, 0), 7 * 3.14159f / 180.0f);
 
-  g_msaa_fbo  = new MsaaFBO(WIN_W, WIN_H, 4);
-  g_slateui_msaa_fbo = new MsaaFBO(WIN_W, WIN_H, 4);
-  g_basic_fbo = new BasicFBO(WIN_W, WIN_H);
-  g_slateui_basic_fbo = new BasicFBO(WIN_W, WIN_H);
+  CreateScreenTargets();
   g_depth_fbo = new DepthOnlyFBO(SHADOW_RES, SHADOW_RES);
+  g_static_depth_fbo = new DepthOnlyFBO(SHADOW_RES, SHADOW_RES);
 
   Triangle::Init(g_programs[0]);
   ColorCube::Init(g_programs[0]);
   MainMenu::InitStatic(g_programs[6]);
   Chunk::program = g_programs[1];
+  Chunk::depth_program = g_programs[4];
   FullScreenQuad::Init(g_programs[2], g_programs[3]);
   TextMessage::InitStatic(g_programs[6]);
 
@@ -268,55 +306,149 @@ void MyInit() {
   
   g_climbscene = new ClimbScene();
   g_climbscene->Init();
+
+  g_mainmenu->PrewarmGlyphs();
+  ClimbScene::PrewarmGlyphs();
 }
 
-void IssueDrawCalls() {
+// 画渲染列表中 [first, last) 的部分；last < 0 表示画到最后，再加上 g_projectiles
+// depth_only：Chunk 换成只写深度的 program，线框（光标、高亮）不投影，和 D3D11 一样
+void IssueDrawCalls(int first = 0, int last = -1, bool depth_only = false) {
   GameScene* scene = GetCurrentGameScene();
   if (scene) {
+    Chunk::depth_only = depth_only;
     std::vector<Sprite*>* sprites = GetCurrentGameScene()->GetSpriteListForRender();
-    for (Sprite* s : *sprites) {
-      if (s) s->Render();
+    const int end = (last < 0) ? int(sprites->size()) : std::min(last, int(sprites->size()));
+    for (int i = first; i < end; i++) {
+      Sprite* s = sprites->at(i);
+      if (!s) continue;
+      if (depth_only && s->draw_mode != Sprite::DrawMode::NORMAL) continue;
+      s->Render();
+    }
+    if (last < 0) {
+      for (Sprite* s : g_projectiles) s->Render();
     }
-    for (Sprite* s : g_projectiles) s->Render();
+    Chunk::depth_only = false;
   }
 }
 
-void RenderScene(const glm::mat4& V, const glm::mat4& P) {
-  // Clear
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glClearColor(1.0f, 1.0f, 0.8f, 0.0f);
+// 渲染列表 [first, last) 里所有投影的精灵的世界包围盒；没有的话返回 false
+bool GetShadowCasterBounds(glm::vec3* lb, glm::vec3* ub, int first = 0, int last = -1) {
+  GameScene* scene = GetCurrentGameScene();
+  if (!scene) return false;
+  std::vector<Sprite*>* sprites = scene->GetSpriteListForRender();
+  const int end = (last < 0) ? int(sprites->size()) : std::min(last, int(sprites->size()));
+  *lb = glm::vec3(1e20f); *ub = glm::vec3(-1e20f);
+  bool any = false;
+  for (int i = first; i < end; i++) {
+    Sprite* s = sprites->at(i);
+    AABB aabb;
+    if (!s || s->draw_mode != Sprite::DrawMode::NORMAL || !s->GetWorldBounds(&aabb)) continue;
+    *lb = glm::min(*lb, aabb.lb); *ub = glm::max(*ub, aabb.ub);
+    any = true;
+  }
+  return any;
+}
+
+// 主 Pass 的顺序：按离相机从近到远，差不多远的再按模型放在一起。
+// 先画近的，远处被挡住的片元就过不了深度测试，不用跑 AO 和阴影
+struct DrawItem {
+  int bucket;          // 视空间深度 / DRAW_SORT_BUCKET
+  const void* model;
+  Sprite* sprite;
+};
+static std::vector<DrawItem> g_sorted_draws;
+const float DRAW_SORT_BUCKET = 16.0f;
+
+void SortDrawCalls(const glm::mat4& V) {
+  g_sorted_draws.clear();
+  GameScene* scene = GetCurrentGameScene();
+  if (!scene) return;
+  auto add = [&](Sprite* s) {
+    if (!s) return;
+    const float depth = -(V * glm::vec4(s->pos, 1)).z;
+    DrawItem item = { int(floorf(depth / DRAW_SORT_BUCKET)), s->GetModelKey(), s };
+    g_sorted_draws.push_back(item);
+  };
+  for (Sprite* s : *(scene->GetSpriteListForRender())) add(s);
+  for (Sprite* s : g_projectiles) add(s);
+  std::sort(g_sorted_draws.begin(), g_sorted_draws.end(), [](const DrawItem& a, const DrawItem& b) {
+    if (a.bucket != b.bucket) return a.bucket < b.bucket;
+    return std::less<const void*>()(a.model, b.model);
+  });
+}
+
+// 相机的预深度和后面的着色画的是同一批东西（WIREFRAME 的也在内）：着色时不写深度，
+// 漏掉的就没有深度了。不投影的只在阴影 Pass（IssueDrawCalls）里跳过
+void IssueSortedDrawCalls(bool depth_only) {
+  Chunk::depth_only = depth_only;
+  for (const DrawItem& d : g_sorted_draws) {
+    d.sprite->Render();
+  }
+  Chunk::depth_only = false;
+}
+
+// 阴影 Pass：只写深度，不跑调色板和法线，也不写颜色
+void RenderSceneDepthOnly(const glm::mat4& V, const glm::mat4& P, int first = 0, int last = -1) {
+  glClear(GL_DEPTH_BUFFER_BIT);
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
-  glEnable(GL_MULTISAMPLE);
   glCullFace(GL_BACK);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-  // Set V and P to all shaders
-  for (unsigned i=0; i<sizeof(g_programs)/sizeof(g_programs[0]); i++) {
-    glUseProgram(g_programs[i]);
-    GLuint vLoc = glGetUniformLocation(g_programs[i], "V");
-    glUniformMatrix4fv(vLoc, 1, GL_FALSE, &V[0][0]);
-    GLuint pLoc = glGetUniformLocation(g_programs[i], "P");
-    glUniformMatrix4fv(pLoc, 1, GL_FALSE, &P[0][0]);
-  }
-  MyCheckGLError("set uniforms");
-
-  // Set Directional light
-  glUseProgram(g_programs[1]);
-  GLuint dlLoc = glGetUniformLocation(g_programs[1], "dir_light");
-  glUniform3f(dlLoc, g_dir_light->dir.x,
-                     g_dir_light->dir.y,
-                     g_dir_light->dir.z);
+  glUseProgram(Chunk::depth_program);
+  GLint vLoc = glGetUniformLocation(Chunk::depth_program, "V");
+  glUniformMatrix4fv(vLoc, 1, GL_FALSE, &V[0][0]);
+  GLint pLoc = glGetUniformLocation(Chunk::depth_program, "P");
+  glUniformMatrix4fv(pLoc, 1, GL_FALSE, &P[0][0]);
   glUseProgram(0);
 
-  IssueDrawCalls();
+  IssueDrawCalls(first, last, true);
 
-  MyCheckGLError("Render Scene");
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  MyCheckGLError("RenderSceneDepthOnly");
+}
+
+// 平台和背景的阴影不常变，单独画在 g_static_depth_fbo 里，用自己的投影：
+// 包住所有静态投影物，不跟相机走，只有它们或者光变了才重算、重画；
+// 采样时和每帧跟着相机收紧的动态层取近的那个
+static bool g_static_shadow_valid = false;
+static GameScene* g_static_shadow_scene = nullptr;
+static unsigned g_static_shadow_version = 0;
+static glm::mat4 g_static_shadow_V;
+static bool g_static_shadow_fit = false;
+static glm::mat4 g_static_shadow_P, g_static_shadow_lightPV;
+
+void UpdateStaticShadowMap(GameScene* scene) {
+  const unsigned version = scene->GetStaticShadowVersion();
+  if (g_static_shadow_valid && g_static_shadow_scene == scene &&
+      g_static_shadow_version == version && g_static_shadow_V == g_dir_light->V &&
+      g_static_shadow_fit == g_fit_shadow) {
+    return;
+  }
+  PROFILE_SCOPE("static shadow");
+  glm::vec3 lb, ub;
+  const int num_static = scene->GetNumStaticSprites();
+  if (g_fit_shadow && GetShadowCasterBounds(&lb, &ub, 0, num_static)) {
+    g_static_shadow_P = g_dir_light->FitToBounds(lb, ub);
+  } else {
+    g_static_shadow_P = g_dir_light->P;  // 不收紧时 P 一直是默认的那个
+  }
+  g_static_shadow_lightPV = g_static_shadow_P * g_dir_light->V;
+  g_static_depth_fbo->Bind();
+  RenderSceneDepthOnly(g_dir_light->V, g_static_shadow_P, 0, num_static);
+  g_static_depth_fbo->Unbind();
+  g_static_shadow_valid = true;
+  g_static_shadow_scene = scene;
+  g_static_shadow_version = version;
+  g_static_shadow_V = g_dir_light->V;
+  g_static_shadow_fit = g_fit_shadow;
 }
 
 void RenderSceneWithShadow(
     const glm::mat4& V, const glm::mat4& P,
-    const glm::mat4& lightPV,
-    GLuint shadow_map) {
+    const glm::mat4& lightPV, const glm::mat4& static_lightPV,
+    GLuint shadow_map, GLuint static_shadow_map) {
 
   // Clear
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -327,6 +459,8 @@ void RenderSceneWithShadow(
   glCullFace(GL_BACK);
 
   // Bind shadow texture
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, static_shadow_map);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, shadow_map);
 
@@ -341,10 +475,18 @@ void RenderSceneWithShadow(
     if (lpvLoc != -1) {
       glUniformMatrix4fv(lpvLoc, 1, GL_FALSE, &lightPV[0][0]);
     }
+    GLint slpvLoc = glGetUniformLocation(g_programs[i], "lightPV_static");
+    if (slpvLoc != -1) {
+      glUniformMatrix4fv(slpvLoc, 1, GL_FALSE, &static_lightPV[0][0]);
+    }
     GLint shadowmapLoc = glGetUniformLocation(g_programs[i], "shadow_map");
     if (shadowmapLoc != -1) {
       glUniform1i(shadowmapLoc, 0);
     }
+    GLint staticshadowmapLoc = glGetUniformLocation(g_programs[i], "shadow_map_static");
+    if (staticshadowmapLoc != -1) {
+      glUniform1i(staticshadowmapLoc, 1);
+    }
   }
 
   // Set Directional light
@@ -355,11 +497,40 @@ void RenderSceneWithShadow(
                      g_dir_light->dir.z);
   glUseProgram(0);
 
-  IssueDrawCalls();
+  SortDrawCalls(V);
+  if (g_depth_prepass) {
+    // 先只写深度，再用 LEQUAL 画一遍，每个像素只着色一次
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    IssueSortedDrawCalls(true);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+  }
+  IssueSortedDrawCalls(false);
+  if (g_depth_prepass) {
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+  }
 
   MyCheckGLError("RenderSceneWithShadow");
 
+  glActiveTexture(GL_TEXTURE1);
   glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// 按读回的主场景 GPU 时间调整 g_render_scale。片元的开销和像素数成正比，所以按面积算。
+// 读回的结果晚 NUM_FRAMES 帧，所以要按测它时的比例算，不是现在的；每个结果只用一次，
+// 每次只走一半，再留一点余量，免得来回跳
+void UpdateRenderScale() {
+  if (!g_dynamic_res) { g_render_scale = 1.0f; return; }
+  float ms, scale;
+  if (!GpuTimer::TakeScaledSample(&ms, &scale) || ms <= 0) return;
+  float target = scale * sqrtf(SCENE_GPU_BUDGET_MS / ms);
+  target = std::max(MIN_RENDER_SCALE, std::min(1.0f, target));
+  if (fabsf(target - g_render_scale) < 0.02f) return;
+  g_render_scale += (target - g_render_scale) * 0.5f;
 }
 
 void render() {
@@ -367,74 +538,138 @@ void render() {
   // 0: Prepare
   GetCurrentGameScene()->PreRender();
   GetCurrentGameScene()->PrepareSpriteListForRender();
+  GpuTimer::BeginFrame();
+  UpdateRenderScale();
+  const int scene_w = std::max(1, int(WIN_W * g_render_scale)), scene_h = std::max(1, int(WIN_H * g_render_scale));
+  const bool scaled = (scene_w != WIN_W || scene_h != WIN_H);
+  ChunkGrid::lod_focal_px = g_voxel_lod ? g_projection[1][1] * 0.5f * scene_h : 0;
 
   // 1: DEPTH PASS
-  g_depth_fbo->Bind();
-  if (g_shadows) {
-    RenderScene(g_dir_light->V, g_dir_light->P);
-  } else {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glClearColor(.0f, .0f, .0f, .0f);
-  }
-  g_depth_fbo->Unbind();
+  {
+    PROFILE_SCOPE("depth pass");
+    GpuTimer::BeginPass("depth pass");
+    GameScene* scene = GetCurrentGameScene();
+    if (g_shadows) {
+      glm::vec3 lb, ub;
+      UpdateStaticShadowMap(scene);
+      // 动态层才跟着相机收紧
+      if (g_fit_shadow && GetShadowCasterBounds(&lb, &ub, scene->GetNumStaticSprites(), -1)) {
+        g_dir_light->FitToFrustum(g_projection * cam->GetViewMatrix(), lb, ub);
+      }
+      g_depth_fbo->Bind();
+      RenderSceneDepthOnly(g_dir_light->V, g_dir_light->P, scene->GetNumStaticSprites(), -1);
+      g_depth_fbo->Unbind();
+    } else {
+      DepthOnlyFBO* fbos[] = { g_depth_fbo, g_static_depth_fbo };
+      for (DepthOnlyFBO* fbo : fbos) {
+        fbo->Bind();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(.0f, .0f, .0f, .0f);
+        fbo->Unbind();
+      }
+      g_static_shadow_valid = false;
+    }
+    GpuTimer::EndPass();
 
-  glFlush();
+    glFlush();
+  }
 
   // 2: Main Pass, with shadows applied
-  if (g_aa) {
-    g_msaa_fbo->Bind();
-    RenderSceneWithShadow(cam->GetViewMatrix(),
-        g_projection,
-        g_dir_light->P * g_dir_light->V,
-        g_depth_fbo->tex);
-    g_msaa_fbo->Unbind();
-
-    // 2. Copy to Singlesample FBO
-    g_msaa_fbo->BlitTo(g_basic_fbo);
-  } else {
-    g_basic_fbo->Bind();
-    RenderSceneWithShadow(cam->GetViewMatrix(),
-            g_projection,
-            g_dir_light->P * g_dir_light->V,
-            g_depth_fbo->tex);
-    g_basic_fbo->Unbind();
+  //    原始分辨率时结果直接放进窗口的 framebuffer，不再经过 g_basic_fbo；
+  //    缩小时画在左下角 scene_w x scene_h，再拉伸到窗口
+  {
+    PROFILE_SCOPE("main pass");
+    // 只有这一段跟着 g_render_scale 变，单独计时给 UpdateRenderScale 用
+    GpuTimer::BeginPass("main pass", g_render_scale);
+    if (g_aa) {
+      g_msaa_fbo->Bind();
+      glViewport(0, 0, scene_w, scene_h);
+      RenderSceneWithShadow(cam->GetViewMatrix(),
+          g_projection,
+          g_dir_light->P * g_dir_light->V, g_static_shadow_lightPV,
+          g_depth_fbo->tex, g_static_depth_fbo->tex);
+      g_msaa_fbo->Unbind();
+    } else {
+      if (!scaled) glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      else g_basic_fbo->Bind();
+      glViewport(0, 0, scene_w, scene_h);
+      RenderSceneWithShadow(cam->GetViewMatrix(),
+              g_projection,
+              g_dir_light->P * g_dir_light->V, g_static_shadow_lightPV,
+              g_depth_fbo->tex, g_static_depth_fbo->tex);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    GpuTimer::EndPass();
+
+    // 2. Resolve to the window
+    if (g_aa || scaled) {
+      GpuTimer::BeginPass("resolve");
+      if (g_aa) {
+        if (!scaled) g_msaa_fbo->BlitToDefault();
+        else g_msaa_fbo->BlitTo(g_basic_fbo, scene_w, scene_h);
+      }
+      if (scaled) g_basic_fbo->UpscaleToDefault(scene_w, scene_h, WIN_W, WIN_H);
+      GpuTimer::EndPass();
+    }
   }
 
-  // 3. Draw the rendered texture
-
   glFlush();
 
-  // 4. Draw UI
-  g_slateui_msaa_fbo->Bind();
+  // 3. Draw UI
+  //    先记下要画的字；没有 UI 的时候 UI 的 FBO 和合成都省掉。
+  //    和上一帧一模一样（字、位置、颜色都没变，也没有新字形光栅化好）就不重画，
+  //    接着用 g_slateui_basic_fbo 里上次的结果
+  static std::vector<TextDrawCall> ui_calls, prev_ui_calls;
+  static int prev_ui_generation = -1;
+  {
+    PROFILE_SCOPE("ui pass");
+    ui_calls.clear();
+    BeginRecordText(&ui_calls);
 
-  glViewport(0, 0, WIN_W, WIN_H);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glClearColor(.0f, .0f, .0f, .0f);
+    // FOR DEBUGGING TEXT RENDER
+    glm::mat4 uitransform(1);
+    uitransform *= glm::rotate(uitransform, g_cam_rot_x, glm::vec3(0.0f,1.0f,0.0f));
+    uitransform *= glm::rotate(uitransform, g_cam_rot_y, glm::vec3(1.0f,0.0f,0.0f));
 
-  // FOR DEBUGGING TEXT RENDER
-  glm::mat4 uitransform(1);
-  uitransform *= glm::rotate(uitransform, g_cam_rot_x, glm::vec3(0.0f,1.0f,0.0f));
-  uitransform *= glm::rotate(uitransform, g_cam_rot_y, glm::vec3(1.0f,0.0f,0.0f));
+    GameScene* scene = GetCurrentGameScene();
+    if (scene) scene->RenderHUD();
 
-  GameScene* scene = GetCurrentGameScene();
-  if (scene) scene->RenderHUD();
+    {
+      if (g_main_menu_visible) {
+        g_mainmenu->Render(uitransform);
+      }
+    }
 
-  {
-    if (g_main_menu_visible) {
-      g_mainmenu->Render(uitransform);
+    Profiler::RenderOverlay(ClimbOpenGL);
+    EndRecordText();
+
+    const bool ui_changed = g_ui_layer_dirty || ui_calls != prev_ui_calls ||
+                            g_glyph_atlas.generation != prev_ui_generation;
+    if (!ui_calls.empty() && ui_changed) {
+      GpuTimer::BeginPass("ui pass");
+      g_slateui_msaa_fbo->Bind();
+      glViewport(0, 0, WIN_W, WIN_H);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glClearColor(.0f, .0f, .0f, .0f);
+      ReplayText(ui_calls);
+      g_slateui_msaa_fbo->Unbind();
+      g_slateui_msaa_fbo->BlitTo(g_slateui_basic_fbo);
+      GpuTimer::EndPass();
     }
+    g_ui_layer_dirty = false;
+    prev_ui_generation = g_glyph_atlas.generation;
+    prev_ui_calls.swap(ui_calls);
   }
 
-  g_slateui_msaa_fbo->Unbind();
-  g_slateui_msaa_fbo->BlitTo(g_slateui_basic_fbo);
-
-  glViewport(0, 0, WIN_W, WIN_H);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-  // Show depth g_fullscreen_quad->RenderDepth(g_depth_fbo->tex);
-  g_fullscreen_quad->Render(g_basic_fbo->tex);
-
-  g_fullscreen_quad->RenderWithBlend(g_slateui_basic_fbo->tex);
+  // 4. UI 盖在场景上
+  if (!prev_ui_calls.empty()) {
+    GpuTimer::BeginPass("composite");
+    glViewport(0, 0, WIN_W, WIN_H);
+    // Show depth g_fullscreen_quad->RenderDepth(g_depth_fbo->tex);
+    g_fullscreen_quad->RenderWithBlend(g_slateui_basic_fbo->tex);
+    GpuTimer::EndPass();
+  }
+  GpuTimer::EndFrame();
 
   glFlush();
 
@@ -444,27 +679,52 @@ void render() {
   GetCurrentGameScene()->PostRender();
 }
 
+#endif
+
+// 推进 n 个固定步长，不依赖窗口和渲染，可以在无头环境下直接调用
+void Step(int n) {
+  const float frames = SIM_DT * SIM_REF_FPS;
+  for (int i = 0; i < n; i++) {
+    {
+      const float X = 0.002f, DECAY = 0.95f;
+      g_cam_rot_x -= X * g_arrow_dx * frames; // DEGREES
+      g_cam_rot_y += X * g_arrow_dy * frames;
+      g_cam_rot_x *= powf(DECAY, frames);
+      g_cam_rot_y *= powf(DECAY, frames);
+    }
+
+    GameScene* scene = GetCurrentGameScene();
+    Camera* cam = GetCurrentSceneCamera();
+    scene->BeginStep();
+    cam->vel = glm::vec3(0, 0,-60) * float(g_cam_dy) +
+          glm::vec3(60,0, 0 ) * float(g_cam_dx) +
+          glm::vec3(0, 60,0) * float(g_cam_dz);
+    cam->Update(SIM_DT);
+    scene->Update(SIM_DT);
+    g_sim_secs += SIM_DT;
+  }
+}
+
+#ifndef CYCLIMB_HEADLESS
 void update() {
+  Profiler::NewFrame();
+  PROFILE_SCOPE("update");
+
   unsigned elapsed = GetElapsedMillis();
   float secs = (elapsed - g_last_millis) * 0.001f;
-
-  {
-    const float X = 0.002f, DECAY = 0.95f;
-    g_cam_rot_x -= X * g_arrow_dx; // DEGREES
-    g_cam_rot_y += X * g_arrow_dy;
-    g_cam_rot_x *= DECAY;
-    g_cam_rot_y *= DECAY;
-  }
+  if (secs > SIM_MAX_FRAME_SECS) secs = SIM_MAX_FRAME_SECS;
 
   Camera* cam = GetCurrentSceneCamera();
   
   // 每帧更新的东西
-  cam->vel = glm::vec3(0, 0,-60) * float(g_cam_dy) +
-        glm::vec3(60,0, 0 ) * float(g_cam_dx) +
-        glm::vec3(0, 60,0) * float(g_cam_dz);
-  cam->Update(secs);
   g_mainmenu->Update(secs);
-  GetCurrentGameScene()->Update(secs);
+
+  // 模拟按固定步长走
+  g_sim_accum += secs;
+  int num_steps = int(g_sim_accum / SIM_DT);
+  g_sim_accum -= num_steps * SIM_DT;
+  Step(num_steps);
+  g_sim_alpha = g_sim_accum / SIM_DT;
 
   if (IsD3D11()) {
     // 这是当时为了解答以下知乎问题而做的演示场景而准备的
@@ -645,11 +905,18 @@ void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
 {
   printf("Framebuffer size set to %dx%d\n", width, height);
   glViewport(0, 0, width, height);
+  if (width < 1 || height < 1) return; // 最小化
+  if (width == WIN_W && height == WIN_H) return;
+  WIN_W = width; WIN_H = height;
+  g_projection = glm::perspective(60.0f*3.14159f/180.0f, WIN_W*1.0f/WIN_H, 0.1f, 499.0f);
+  CreateScreenTargets();
 }
 
 //void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 void ProcessInput(GLFWwindow* window, int key, int scancode, int action, int mods) {
-  
+  // 性能统计
+  if (key == GLFW_KEY_F3 && action == GLFW_PRESS) Profiler::Toggle();
+  if (key == GLFW_KEY_F4 && action == GLFW_PRESS) Profiler::DumpChromeTrace("cyclimb_trace.json");
 
   if (g_main_menu_visible) {
     if (key == GLFW_KEY_UP && action == GLFW_PRESS) g_mainmenu->OnUpDownPressed(-1);
@@ -844,7 +1111,7 @@ int main_opengl(int argc, char** argv) {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+  glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
 
   glewExperimental = GL_TRUE;
 
@@ -930,6 +1197,8 @@ int main_opengl(int argc, char** argv) {
   return 0;
 }
 
+#endif
+
 void StartGame(bool spawn_player = false) {
   g_main_menu_visible = false;
   if (spawn_player) g_climbscene->SpawnPlayer();
@@ -947,8 +1216,15 @@ void ExitEditMode() {
 
 extern int main_d3d11(int argc, char** argv);
 extern int main_d3d12(int argc, char** argv);
+extern int main_headless(int argc, char** argv);
+extern int main_particlebench(int argc, char** argv);
 
 int main(int argc, char** argv) {
+#ifdef CYCLIMB_HEADLESS
+  bool headless = true; // 这个版本没有窗口
+#else
+  bool headless = false;
+#endif
   for (int i = 1; i < argc; i++) {
     if (!strcmp(argv[i], "opengl")) { g_api = ClimbOpenGL; }
     else if (!strcmp(argv[i], "d3d11")) { g_api = ClimbD3D11; }
@@ -956,8 +1232,27 @@ int main(int argc, char** argv) {
     else if (!strcmp(argv[i], "testscene")) { g_scene_idx = 0; }
     else if (!strcmp(argv[i], "cyclimb")) { g_scene_idx = 1; }
     else if (!strcmp(argv[i], "lighttest")) { g_scene_idx = 2; }
+    else if (!strcmp(argv[i], "headless")) { headless = true; }
+    else if (!strcmp(argv[i], "particlebench")) { return main_particlebench(argc, argv); }
+    else if (!strcmp(argv[i], "profile")) { Profiler::enabled = true; }
+#ifndef CYCLIMB_HEADLESS
+    else if (!strcmp(argv[i], "sdf")) { g_sdf_text = true; }
+    else if (!strcmp(argv[i], "gpuparticles")) { g_gpu_particles = true; }
+#endif
+    else if (!strcmp(argv[i], "fixedshadow")) { g_fit_shadow = false; }
+    else if (!strcmp(argv[i], "nolod")) { g_voxel_lod = false; }
+    else if (!strcmp(argv[i], "prepass")) { g_depth_prepass = true; }
+#ifndef CYCLIMB_HEADLESS
+    else if (!strcmp(argv[i], "dynres")) { g_dynamic_res = true; GpuTimer::always_on = true; }
+#endif
+  }
+
+  // 不开窗口，也不初始化声音
+  if (headless) {
+    return main_headless(argc, argv);
   }
 
+#ifndef CYCLIMB_HEADLESS
   InitSounds();
 
   switch (g_api) {
@@ -974,4 +1269,5 @@ int main(int argc, char** argv) {
       break;
     }
   }
-}
\ No newline at end of file
+#endif
+}
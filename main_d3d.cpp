@@ -16,12 +16,13 @@
 #include "testshapes.hpp"
 #include "scene.hpp"
 #include "textrender.hpp"
+#include "profiler.hpp"
+#include "gputimer.hpp"
 #include <DirectXMath.h>
 
 #include "WICTextureLoader.h"
 
 extern GraphicsAPI g_api;
-extern Character_D3D11 GetCharacter_D3D11(wchar_t ch);
 extern void Render_D3D12();
 
 extern int WIN_W, WIN_H, SHADOW_RES;
@@ -79,6 +80,7 @@ ID3D11Buffer* g_perscene_cb_light11;
 ID3D11Buffer* g_simpletexture_cb;
 ID3D11Buffer* g_lightscatter_cb;
 ID3D11InputLayout* g_inputlayout_voxel11;
+ID3D11InputLayout* g_inputlayout_voxel_instanced11;
 ID3D11BlendState* g_blendstate11;
 ID3D11Buffer* g_fsquad_for_light11;
 ID3D11Buffer* g_fsquad_for_lightscatter11;
@@ -132,11 +134,13 @@ struct VolumetricLightCB g_vol_light_cb;
 
 // Shaders ..
 ID3DBlob *g_vs_default_palette_blob, *g_ps_default_palette_blob;
+ID3DBlob *g_vs_default_palette_instanced_blob;
 ID3DBlob *g_ps_default_palette_shadowed_blob;
 ID3DBlob *g_vs_textrender_blob, *g_ps_textrender_blob;
 ID3DBlob *g_vs_light_blob, *g_ps_light_blob;
 ID3DBlob* g_vs_simpletexture_blob, * g_ps_simpletexture_blob;
 ID3D11VertexShader* g_vs_default_palette;
+ID3D11VertexShader* g_vs_default_palette_instanced;
 ID3D11VertexShader* g_vs_textrender;
 ID3D11VertexShader* g_vs_light;
 ID3D11VertexShader* g_vs_simpletexture;
@@ -433,6 +437,10 @@ void InitAssets11() {
   assert(SUCCEEDED(g_device11->CreateVertexShader(g_vs_default_palette_blob->GetBufferPointer(),
     g_vs_default_palette_blob->GetBufferSize(), nullptr, &g_vs_default_palette)));
 
+  CE(D3DCompileFromFile(L"shaders_hlsl/default_palette.hlsl", nullptr, nullptr, "VSMainInstanced", "vs_4_0", compileFlags, 0, &g_vs_default_palette_instanced_blob, &error), error);
+  assert(SUCCEEDED(g_device11->CreateVertexShader(g_vs_default_palette_instanced_blob->GetBufferPointer(),
+    g_vs_default_palette_instanced_blob->GetBufferSize(), nullptr, &g_vs_default_palette_instanced)));
+
   CE(D3DCompileFromFile(L"shaders_hlsl/default_palette.hlsl", nullptr, nullptr, "PSMainWithoutShadow", "ps_4_0", compileFlags, 0, &g_ps_default_palette_blob, &error), error);
   assert(SUCCEEDED(g_device11->CreatePixelShader(g_ps_default_palette_blob->GetBufferPointer(),
     g_ps_default_palette_blob->GetBufferSize(), nullptr, &g_ps_default_palette)));
@@ -499,6 +507,19 @@ void InitAssets11() {
   assert(SUCCEEDED(g_device11->CreateInputLayout(inputdesc1, 4, g_vs_default_palette_blob->GetBufferPointer(),
     g_vs_default_palette_blob->GetBufferSize(), &g_inputlayout_voxel11)));
 
+  // 粒子：x、y、z 偏移各占一个槽，绑的是同一个缓冲的不同位置
+  D3D11_INPUT_ELEMENT_DESC inputdesc_instanced[] = {
+    { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "COLOR"   , 0, DXGI_FORMAT_R32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "COLOR"   , 1, DXGI_FORMAT_R32_FLOAT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "COLOR"   , 2, DXGI_FORMAT_R32_FLOAT, 0, 20, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "INSTANCE_POS", 0, DXGI_FORMAT_R32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "INSTANCE_POS", 1, DXGI_FORMAT_R32_FLOAT, 2, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "INSTANCE_POS", 2, DXGI_FORMAT_R32_FLOAT, 3, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+  };
+  assert(SUCCEEDED(g_device11->CreateInputLayout(inputdesc_instanced, 7, g_vs_default_palette_instanced_blob->GetBufferPointer(),
+    g_vs_default_palette_instanced_blob->GetBufferSize(), &g_inputlayout_voxel_instanced11)));
+
   // Fullscreen quad
   {
     float data[][4] = {  // N D C       TexCoord
@@ -840,6 +861,8 @@ void MyInit_D3D11() {
 
   // Depends on ClimbScene's static resources
   g_mainmenu = new MainMenu();
+  g_mainmenu->PrewarmGlyphs();
+  ClimbScene::PrewarmGlyphs();
 }
 
 void Render_D3D11() {
@@ -865,8 +888,12 @@ void Render_D3D11() {
     g_context11->PSSetSamplers(0, 1, &sampler_empty);
     g_context11->IASetInputLayout(g_inputlayout_voxel11);
 
+    GpuTimer::BeginFrame();
+
     // Shadow Pass
     if (g_shadows) {
+      PROFILE_SCOPE("depth pass");
+      GpuTimer::BeginPass("depth pass");
       ID3D11ShaderResourceView* srv_empty = nullptr;
       g_context11->PSSetShaderResources(0, 1, &srv_empty);
       ID3D11RenderTargetView* rtv_empty = nullptr;
@@ -880,33 +907,41 @@ void Render_D3D11() {
       P = g_dir_light->GetP_D3D11_DXMath();
       V = g_dir_light->GetV_D3D11();
       RenderScene_D3D11(V, P, Sprite::DrawMode::NORMAL);
+      GpuTimer::EndPass();
     }
 
     // Normal Pass
     ID3D11RenderTargetView* rtvs[] = { g_backbuffer_rtv11, g_gbuffer_rtv11 };
-    g_context11->OMSetRenderTargets(2, rtvs, g_dsv11);
-    g_context11->RSSetViewports(1, &g_viewport11);
-    g_context11->RSSetScissorRects(1, &g_scissorrect11);
-    g_context11->VSSetShader(g_vs_default_palette, nullptr, 0);
-    g_context11->PSSetShader(g_ps_default_palette_shadowed, nullptr, 0);
-    g_context11->PSSetShaderResources(0, 1, &g_shadowmap_srv11);
-    g_context11->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    g_context11->IASetInputLayout(g_inputlayout_voxel11);
-    g_context11->PSSetSamplers(0, 1, &g_sampler11);
-    g_context11->RSSetState(g_rsstate_normal11);
+    {
+      PROFILE_SCOPE("main pass");
+      GpuTimer::BeginPass("main pass");
+      g_context11->OMSetRenderTargets(2, rtvs, g_dsv11);
+      g_context11->RSSetViewports(1, &g_viewport11);
+      g_context11->RSSetScissorRects(1, &g_scissorrect11);
+      g_context11->VSSetShader(g_vs_default_palette, nullptr, 0);
+      g_context11->PSSetShader(g_ps_default_palette_shadowed, nullptr, 0);
+      g_context11->PSSetShaderResources(0, 1, &g_shadowmap_srv11);
+      g_context11->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+      g_context11->IASetInputLayout(g_inputlayout_voxel11);
+      g_context11->PSSetSamplers(0, 1, &g_sampler11);
+      g_context11->RSSetState(g_rsstate_normal11);
 
-    RenderScene_D3D11(cam->GetViewMatrix_D3D11(), g_projection_d3d11, Sprite::DrawMode::NORMAL);
+      RenderScene_D3D11(cam->GetViewMatrix_D3D11(), g_projection_d3d11, Sprite::DrawMode::NORMAL);
 
-    // Wireframe Pass
-    g_context11->RSSetState(g_rsstate_wireframe11);
-    RenderScene_D3D11(cam->GetViewMatrix_D3D11(), g_projection_d3d11, Sprite::DrawMode::WIREFRAME);
+      // Wireframe Pass
+      g_context11->RSSetState(g_rsstate_wireframe11);
+      RenderScene_D3D11(cam->GetViewMatrix_D3D11(), g_projection_d3d11, Sprite::DrawMode::WIREFRAME);
 
-    g_context11->RSSetState(nullptr);
+      g_context11->RSSetState(nullptr);
+      GpuTimer::EndPass();
+    }
 
     GameScene* scene = GetCurrentGameScene();
 
     if (true) {
       // Volumetric lights
+      PROFILE_SCOPE("lights");
+      GpuTimer::BeginPass("lights");
       if (scene) {
         if (1) {
           scene->PrepareLights();
@@ -914,35 +949,46 @@ void Render_D3D11() {
           scene->RenderLights();
         }
       }
+      GpuTimer::EndPass();
     }
 
     // U I
-    glm::mat4 uitransform(1);
-    uitransform *= glm::rotate(uitransform, g_cam_rot_x, glm::vec3(0.0f, 1.0f, 0.0f));
-    uitransform *= glm::rotate(uitransform, g_cam_rot_y, glm::vec3(1.0f, 0.0f, 0.0f));
-
-    ID3D11Buffer* cbs[] = { g_perobject_cb_default_palette, g_perscene_cb_default_palette };
-    g_context11->VSSetConstantBuffers(0, 2, cbs);
-    g_context11->PSSetConstantBuffers(1, 1, &g_perscene_cb_default_palette);
-    g_context11->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    g_context11->IASetInputLayout(g_inputlayout_voxel11);
-    g_context11->PSSetSamplers(0, 1, &g_sampler11);
-    g_context11->OMSetRenderTargets(2, rtvs, g_dsv11);
-
-    g_context11->OMSetDepthStencilState(g_dsstate_for_text11, 0);
-    if (scene) scene->RenderHUD_D3D11();
-
     {
-      if (g_main_menu_visible) {
-        g_mainmenu->Render_D3D11(uitransform);
+      PROFILE_SCOPE("ui pass");
+      GpuTimer::BeginPass("ui pass");
+      glm::mat4 uitransform(1);
+      uitransform *= glm::rotate(uitransform, g_cam_rot_x, glm::vec3(0.0f, 1.0f, 0.0f));
+      uitransform *= glm::rotate(uitransform, g_cam_rot_y, glm::vec3(1.0f, 0.0f, 0.0f));
+
+      ID3D11Buffer* cbs[] = { g_perobject_cb_default_palette, g_perscene_cb_default_palette };
+      g_context11->VSSetConstantBuffers(0, 2, cbs);
+      g_context11->PSSetConstantBuffers(1, 1, &g_perscene_cb_default_palette);
+      g_context11->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+      g_context11->IASetInputLayout(g_inputlayout_voxel11);
+      g_context11->PSSetSamplers(0, 1, &g_sampler11);
+      g_context11->OMSetRenderTargets(2, rtvs, g_dsv11);
+
+      g_context11->OMSetDepthStencilState(g_dsstate_for_text11, 0);
+      if (scene) scene->RenderHUD_D3D11();
+
+      {
+        if (g_main_menu_visible) {
+          g_mainmenu->Render_D3D11(uitransform);
+        }
       }
+      Profiler::RenderOverlay(ClimbD3D11);
+      g_context11->OMSetDepthStencilState(nullptr, 0);
+      GpuTimer::EndPass();
     }
-    g_context11->OMSetDepthStencilState(nullptr, 0);
+
+    GpuTimer::EndFrame();
 
     // Image test
     
 
     g_swapchain11->Present(1, 0);
+
+    GetCurrentGameScene()->PostRender();
   }
 }
 
@@ -950,6 +996,10 @@ void OnKeyDown(WPARAM wParam, LPARAM lParam) {
   //printf("KeyDown wParam=%X lParam=%X\n", int(wParam), int(lParam));
   if (lParam & 0x40000000) return;
 
+  // 性能统计
+  if (wParam == VK_F3) Profiler::Toggle();
+  if (wParam == VK_F4) Profiler::DumpChromeTrace("cyclimb_trace.json");
+
   if (wParam == 27) {
     if (g_main_menu_visible) {
       g_mainmenu->OnEscPressed();
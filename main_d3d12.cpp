@@ -14,6 +14,8 @@
 #include "scene.hpp"
 #include "sprite.hpp"
 #include "textrender.hpp"
+#include "profiler.hpp"
+#include "gputimer.hpp"
 #include "util.hpp"
 #include <DirectXMath.h>
 
@@ -324,6 +326,7 @@ void Render_D3D12() {
   CE(g_command_allocator->Reset());
   CE(g_command_list->Reset(g_command_allocator, chunk_pass_normal->pipeline_state_depth_only));
   g_command_list->SetGraphicsRootSignature(chunk_pass_normal->root_signature_default_palette);
+  GpuTimer::BeginFrame();
   
   g_command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
     g_shadow_map,
@@ -331,36 +334,41 @@ void Render_D3D12() {
     D3D12_RESOURCE_STATE_DEPTH_WRITE)));
 
   // Depth pass
-  g_command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-  D3D12_VIEWPORT viewport_depth = CD3DX12_VIEWPORT(0.0f, 0.0f, 1.0f * SHADOW_RES, 1.0f * SHADOW_RES, 0.0f, 1.0f);
-  D3D12_RECT scissor_depth = CD3DX12_RECT(0, 0, long(SHADOW_RES), long(SHADOW_RES));
-  g_command_list->RSSetViewports(1, &viewport_depth);
-  g_command_list->RSSetScissorRects(1, &scissor_depth);
-  g_command_list->ClearDepthStencilView(shadow_map_dsv_handle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
-  g_command_list->OMSetRenderTargets(0, nullptr, FALSE, &shadow_map_dsv_handle);
-
-  g_command_list->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
-  g_command_list->SetGraphicsRootConstantBufferView(1, d_per_scene_cb->GetGPUVirtualAddress());
-  
-  if (sprites != nullptr) {
-    chunk_pass_depth->StartPass();
-    for (Sprite* s : *sprites) {
-      if (s && s->draw_mode == Sprite::DrawMode::NORMAL)
-        s->RecordRenderCommand_D3D12(chunk_pass_depth, g_dir_light->GetV_D3D11(), g_dir_light->GetP_D3D11_DXMath());
-    }
-    chunk_pass_depth->EndPass();
-    const int N = int(chunk_pass_depth->chunk_instances.size());
-    for (int i = 0; i < N; i++) {
-      Chunk* c = chunk_pass_depth->chunk_instances[i];
-      D3D12_GPU_VIRTUAL_ADDRESS cbv0_addr = chunk_pass_depth->d_per_object_cbs->GetGPUVirtualAddress() + 256 * i;
-      g_command_list->SetGraphicsRootConstantBufferView(0, cbv0_addr);  // Per-object CB
-      g_command_list->IASetVertexBuffers(0, 1, &(c->d3d12_vertex_buffer_view));
-      g_command_list->DrawInstanced(c->tri_count * 3, 1, 0, 0);
+  {
+    PROFILE_SCOPE("depth pass");
+    GpuTimer::BeginPass("depth pass");
+    g_command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    D3D12_VIEWPORT viewport_depth = CD3DX12_VIEWPORT(0.0f, 0.0f, 1.0f * SHADOW_RES, 1.0f * SHADOW_RES, 0.0f, 1.0f);
+    D3D12_RECT scissor_depth = CD3DX12_RECT(0, 0, long(SHADOW_RES), long(SHADOW_RES));
+    g_command_list->RSSetViewports(1, &viewport_depth);
+    g_command_list->RSSetScissorRects(1, &scissor_depth);
+    g_command_list->ClearDepthStencilView(shadow_map_dsv_handle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+    g_command_list->OMSetRenderTargets(0, nullptr, FALSE, &shadow_map_dsv_handle);
+
+    g_command_list->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+    g_command_list->SetGraphicsRootConstantBufferView(1, d_per_scene_cb->GetGPUVirtualAddress());
+
+    if (sprites != nullptr) {
+      chunk_pass_depth->StartPass();
+      for (Sprite* s : *sprites) {
+        if (s && s->draw_mode == Sprite::DrawMode::NORMAL)
+          s->RecordRenderCommand_D3D12(chunk_pass_depth, g_dir_light->GetV_D3D11(), g_dir_light->GetP_D3D11_DXMath());
+      }
+      chunk_pass_depth->EndPass();
+      const int N = int(chunk_pass_depth->chunk_instances.size());
+      for (int i = 0; i < N; i++) {
+        Chunk* c = chunk_pass_depth->chunk_instances[i];
+        D3D12_GPU_VIRTUAL_ADDRESS cbv0_addr = chunk_pass_depth->d_per_object_cbs->GetGPUVirtualAddress() + 256 * i;
+        g_command_list->SetGraphicsRootConstantBufferView(0, cbv0_addr);  // Per-object CB
+        g_command_list->IASetVertexBuffers(0, 1, &(c->d3d12_vertex_buffer_view));
+        g_command_list->DrawInstanced(c->tri_count * 3, 1, 0, 0);
+      }
     }
-  }
 
-  CE(g_command_list->Close());
-  g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_command_list);
+    GpuTimer::EndPass();
+    CE(g_command_list->Close());
+    g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_command_list);
+  }
 
   CE(g_command_list->Reset(g_command_allocator, chunk_pass_normal->pipeline_state_default_palette));
   g_command_list->SetGraphicsRootSignature(chunk_pass_normal->root_signature_default_palette);
@@ -393,27 +401,33 @@ void Render_D3D12() {
   g_command_list->SetGraphicsRootConstantBufferView(1, d_per_scene_cb->GetGPUVirtualAddress());
   
 
-  if (sprites != nullptr) {
-    chunk_pass_normal->StartPass();
-    for (Sprite* s : *sprites) {
-      if (s && s->draw_mode == Sprite::DrawMode::NORMAL)
-        s->RecordRenderCommand_D3D12(chunk_pass_normal, cam->GetViewMatrix_D3D11(), g_projection_d3d11);
-    }
-    chunk_pass_normal->EndPass();
-    const int N = int(chunk_pass_depth->chunk_instances.size());
-    for (int i = 0; i < N; i++) {
-      Chunk* c = chunk_pass_normal->chunk_instances[i];
-      D3D12_GPU_VIRTUAL_ADDRESS cbv0_addr = chunk_pass_normal->d_per_object_cbs->GetGPUVirtualAddress() + 256 * i;
-      g_command_list->SetGraphicsRootConstantBufferView(0, cbv0_addr);  // Per-object CB
-      g_command_list->IASetVertexBuffers(0, 1, &(c->d3d12_vertex_buffer_view));
-      g_command_list->DrawInstanced(c->tri_count * 3, 1, 0, 0);
+  {
+    PROFILE_SCOPE("main pass");
+    GpuTimer::BeginPass("main pass");
+    if (sprites != nullptr) {
+      chunk_pass_normal->StartPass();
+      for (Sprite* s : *sprites) {
+        if (s && s->draw_mode == Sprite::DrawMode::NORMAL)
+          s->RecordRenderCommand_D3D12(chunk_pass_normal, cam->GetViewMatrix_D3D11(), g_projection_d3d11);
+      }
+      chunk_pass_normal->EndPass();
+      const int N = int(chunk_pass_depth->chunk_instances.size());
+      for (int i = 0; i < N; i++) {
+        Chunk* c = chunk_pass_normal->chunk_instances[i];
+        D3D12_GPU_VIRTUAL_ADDRESS cbv0_addr = chunk_pass_normal->d_per_object_cbs->GetGPUVirtualAddress() + 256 * i;
+        g_command_list->SetGraphicsRootConstantBufferView(0, cbv0_addr);  // Per-object CB
+        g_command_list->IASetVertexBuffers(0, 1, &(c->d3d12_vertex_buffer_view));
+        g_command_list->DrawInstanced(c->tri_count * 3, 1, 0, 0);
+      }
     }
-  }
 
-  CE(g_command_list->Close());
-  g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_command_list);
+    GpuTimer::EndPass();
+    CE(g_command_list->Close());
+    g_command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_command_list);
+  }
 
   {
+    PROFILE_SCOPE("ui pass");
     glm::mat4 uitransform(1);
     uitransform *= glm::rotate(uitransform, g_cam_rot_x, glm::vec3(0.0f, 1.0f, 0.0f));
     uitransform *= glm::rotate(uitransform, g_cam_rot_y, glm::vec3(1.0f, 0.0f, 0.0f));
@@ -422,6 +436,7 @@ void Render_D3D12() {
     }
     GameScene* scene = GetCurrentGameScene();
     if (scene) scene->RenderHUD_D3D12();
+    Profiler::RenderOverlay(ClimbD3D12);
   }
 
   // TextPass's rendering procedure
@@ -436,16 +451,10 @@ void Render_D3D12() {
   g_command_list->OMSetBlendFactor(blend_factor);
 
   g_command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-  for (size_t i = 0; i < text_pass->characters_to_display.size(); i++) {
-    const TextPass::CharacterToDisplay& ctd = text_pass->characters_to_display[i];
-    g_command_list->IASetVertexBuffers(0, 1, &ctd.vbv);
-    g_command_list->SetGraphicsRootConstantBufferView(0, text_pass->per_scene_cbs->GetGPUVirtualAddress() + sizeof(TextCbPerScene) * ctd.per_scene_cb_index);
-    CD3DX12_GPU_DESCRIPTOR_HANDLE srv_handle(
-      text_pass->srv_heap->GetGPUDescriptorHandleForHeapStart(),
-      ctd.character->offset_in_srv_heap, text_pass->srv_descriptor_size);
-    g_command_list->SetGraphicsRootDescriptorTable(1, srv_handle);
-    g_command_list->DrawInstanced(6, 1, 0, 0);
-  }
+  GpuTimer::BeginPass("text pass");
+  text_pass->RecordRenderCommands();
+  GpuTimer::EndPass();
+  GpuTimer::EndFrame();  // Resolve 进回读缓冲
 
   g_command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
     render_target,
@@ -457,6 +466,8 @@ void Render_D3D12() {
   
   CE(g_swapchain->Present(1, 0));
   WaitForPreviousFrame();
+
+  GetCurrentGameScene()->PostRender();
 }
 
 // Init game-related variables
@@ -494,6 +505,9 @@ void MyInit_D3D12() {
   g_textmessage = new TextMessage();
   g_climbscene->Init();
 
+  g_mainmenu->PrewarmGlyphs();
+  ClimbScene::PrewarmGlyphs();
+
   init_done = true;
 }
 
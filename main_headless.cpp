@@ -0,0 +1,151 @@
+// 无头模式：不开窗口、不建 GL/D3D 上下文、不初始化声音，
+// 只跑 ClimbScene 的模拟，用脚本按键驱动，最后打印各阶段耗时。
+//
+// 用法： cyclimb headless [secs=3600] [profile]
+//        cyclimb_headless [secs=3600] [profile]   （make cyclimb_headless，不需要 GL/GLFW/OpenAL/FreeType）
+
+#include "scene.hpp"
+#include "game.hpp"
+#include "util.hpp"
+#include "profiler.hpp"
+
+#include "textrender.hpp"
+#include "sounds.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern GraphicsAPI g_api;
+extern int g_scene_idx;
+extern bool g_main_menu_visible;
+extern ChunkGrid* g_chunkgrid[4];
+extern Particles* g_particles;
+extern ClimbScene* g_climbscene;
+extern void Step(int n);
+
+#ifdef CYCLIMB_HEADLESS
+// 无头版本不编译 textrender.cpp 和 sounds.cpp，模拟里用到的几个入口在这里什么也不做
+void RenderText(GraphicsAPI api, std::wstring text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color, glm::mat4 transform) { }
+void MeasureTextWidth(std::wstring text, float *w) { *w = 0; }
+void PrewarmText(const std::wstring& text) { }
+void MyPlaySound(CyclimbSound s) { }
+#endif
+
+// MyInit 里和 GPU 无关的部分
+static void MyInit_Headless() {
+  g_chunkgrid[3] = new ChunkGrid(1, 1, 1);
+  g_chunkgrid[3]->SetVoxel(0, 0, 0, 12);
+  Particles::InitStatic(g_chunkgrid[3]);
+  g_particles = new Particles();
+
+  ClimbScene::InitStatic();
+  g_climbscene = new ClimbScene();
+  g_climbscene->Init();
+}
+
+int main_headless(int argc, char** argv) {
+  float sim_secs = 3600.0f;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "secs=", 5)) sim_secs = float(atof(argv[i] + 5));
+  }
+
+  // 顶点按 GL 的格式在 CPU 上生成，但不上传；不渲染就不需要上下文
+  g_api = ClimbOpenGL;
+  Chunk::defer_upload = true;
+  g_scene_idx = 1;
+  g_main_menu_visible = false;
+  srand(1);
+
+  MyInit_Headless();
+  ClimbScene* scene = g_climbscene;
+  const int num_levels = int(scene->levels.size());
+
+  const int steps_per_sec = int(1.0f / SIM_DT + 0.5f);
+  const int total_steps = int(sim_secs * steps_per_sec);
+  const int steps_per_frame = steps_per_sec / 60;       // 模拟 60FPS 的渲染
+  const int steps_per_level = steps_per_sec * 60;       // 每关玩一分钟
+
+  // 脚本按键：按住一个方向键一会儿，松开，再换下一个
+  const char script_keys[] = { 'w', 'q', 'w', 'e', 'a', 'w', 'd', 'e', 'q' };
+  const int num_script_keys = sizeof(script_keys) / sizeof(script_keys[0]);
+  const int hold_steps = steps_per_sec / 4, release_steps = steps_per_sec / 10;
+  int key_idx = 0, next_key_step = 0;
+  char held_key = 0;
+
+  int num_levels_finished = 0, num_frames = 0;
+  int level = 1;
+  scene->StartLevel(level);
+
+  printf("Headless: %d levels, simulating %g s (%d steps of %g s)\n",
+    num_levels, sim_secs, total_steps, SIM_DT);
+
+  const unsigned long long t0 = GetElapsedMicros();
+  for (int i = 0; i < total_steps; i++) {
+    if (i > 0 && i % steps_per_level == 0 && num_levels > 0) {
+      level = level % num_levels + 1;
+      scene->StartLevel(level);
+    }
+
+    switch (scene->game_state) {
+      case ClimbScene::ClimbGameStateNotStarted:
+        scene->SetGameState(ClimbScene::ClimbGameStateStartCountdown);
+        break;
+      case ClimbScene::ClimbGameStateLevelEndWaitKey:
+        num_levels_finished++;
+        scene->OnKeyPressed(' ');
+        level = scene->curr_level;
+        break;
+      default: break;
+    }
+
+    if (i >= next_key_step) {
+      if (held_key) {
+        scene->OnKeyReleased(held_key);
+        held_key = 0;
+        next_key_step = i + release_steps;
+      } else {
+        held_key = script_keys[key_idx % num_script_keys];
+        key_idx++;
+        scene->OnKeyPressed(held_key);
+        next_key_step = i + hold_steps;
+      }
+    }
+
+    Step(1);
+
+    if (i % steps_per_frame == 0) {
+      scene->PreRender();
+      scene->PrepareSpriteListForRender();
+      scene->PostRender();
+      num_frames++;
+    }
+  }
+  const unsigned long long t1 = GetElapsedMicros();
+
+  const double wall_secs = (t1 - t0) * 1e-6;
+  printf("\n");
+  printf("Simulated %g s in %.3f s wall (%.1fx real time)\n",
+    sim_secs, wall_secs, sim_secs / wall_secs);
+  printf("%d steps, %d frames, %d levels finished, %d key presses\n",
+    total_steps, num_frames, num_levels_finished, key_idx);
+
+  const ClimbScene::PhaseTimes& pt = scene->phase_times;
+  struct { const char* name; unsigned long long micros; int count; } phases[] = {
+    { "probe",       pt.probe,       total_steps },
+    { "collision",   pt.collision,   total_steps },
+    { "particles",   pt.particles,   total_steps },
+    { "render_list", pt.render_list, num_frames  },
+  };
+  printf("%-12s %12s %12s\n", "phase", "total ms", "us/call");
+  for (const auto& p : phases) {
+    printf("%-12s %12.3f %12.3f\n", p.name, p.micros * 1e-3,
+      p.count > 0 ? p.micros * 1.0 / p.count : 0.0);
+  }
+
+  if (Profiler::enabled) {
+    Profiler::DumpChromeTrace("cyclimb_headless_trace.json");
+  }
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include "particlekernel.hpp"
+#include "util.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PARTICLE_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static void ParticleKernel_Range(const ParticleArrays& a, int i0, int n, float secs, float k) {
+  for (int i = i0; i < n; i++) {
+    const float f = a.lifetime[i] * a.inv_lifetime_full[i];
+    const float s = f * f * k;
+    a.pos_x[i] += a.vel_x[i] * s;
+    a.pos_y[i] += a.vel_y[i] * s;
+    a.pos_z[i] += a.vel_z[i] * s;
+    a.lifetime[i] -= secs;
+  }
+}
+
+void ParticleKernel_Scalar(const ParticleArrays& a, int n, float secs, float k) {
+  ParticleKernel_Range(a, 0, n, secs, k);
+}
+
+#ifdef PARTICLE_KERNEL_X86
+void ParticleKernel_SSE(const ParticleArrays& a, int n, float secs, float k) {
+  const __m128 vk = _mm_set1_ps(k), vsecs = _mm_set1_ps(secs);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 life = _mm_loadu_ps(a.lifetime + i);
+    const __m128 f = _mm_mul_ps(life, _mm_loadu_ps(a.inv_lifetime_full + i));
+    const __m128 s = _mm_mul_ps(_mm_mul_ps(f, f), vk);
+    _mm_storeu_ps(a.pos_x + i, _mm_add_ps(_mm_loadu_ps(a.pos_x + i), _mm_mul_ps(_mm_loadu_ps(a.vel_x + i), s)));
+    _mm_storeu_ps(a.pos_y + i, _mm_add_ps(_mm_loadu_ps(a.pos_y + i), _mm_mul_ps(_mm_loadu_ps(a.vel_y + i), s)));
+    _mm_storeu_ps(a.pos_z + i, _mm_add_ps(_mm_loadu_ps(a.pos_z + i), _mm_mul_ps(_mm_loadu_ps(a.vel_z + i), s)));
+    _mm_storeu_ps(a.lifetime + i, _mm_sub_ps(life, vsecs));
+  }
+  ParticleKernel_Range(a, i, n, secs, k);
+}
+
+// 不用 FMA，和标量版本结果一致
+TARGET_AVX2 void ParticleKernel_AVX2(const ParticleArrays& a, int n, float secs, float k) {
+  const __m256 vk = _mm256_set1_ps(k), vsecs = _mm256_set1_ps(secs);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 life = _mm256_loadu_ps(a.lifetime + i);
+    const __m256 f = _mm256_mul_ps(life, _mm256_loadu_ps(a.inv_lifetime_full + i));
+    const __m256 s = _mm256_mul_ps(_mm256_mul_ps(f, f), vk);
+    _mm256_storeu_ps(a.pos_x + i, _mm256_add_ps(_mm256_loadu_ps(a.pos_x + i), _mm256_mul_ps(_mm256_loadu_ps(a.vel_x + i), s)));
+    _mm256_storeu_ps(a.pos_y + i, _mm256_add_ps(_mm256_loadu_ps(a.pos_y + i), _mm256_mul_ps(_mm256_loadu_ps(a.vel_y + i), s)));
+    _mm256_storeu_ps(a.pos_z + i, _mm256_add_ps(_mm256_loadu_ps(a.pos_z + i), _mm256_mul_ps(_mm256_loadu_ps(a.vel_z + i), s)));
+    _mm256_storeu_ps(a.lifetime + i, _mm256_sub_ps(life, vsecs));
+  }
+  ParticleKernel_Range(a, i, n, secs, k);
+}
+
+bool CpuHasSSE2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool CpuHasAVX2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx) return false;
+  if ((_xgetbv(0) & 6) != 6) return false; // 操作系统要保存 YMM 寄存器
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#else
+// 不是 x86 就只有标量版本
+void ParticleKernel_SSE(const ParticleArrays& a, int n, float secs, float k) { ParticleKernel_Range(a, 0, n, secs, k); }
+void ParticleKernel_AVX2(const ParticleArrays& a, int n, float secs, float k) { ParticleKernel_Range(a, 0, n, secs, k); }
+bool CpuHasSSE2() { return false; }
+bool CpuHasAVX2() { return false; }
+#endif
+
+ParticleKernelFn GetParticleKernel() {
+  static ParticleKernelFn kernel = nullptr;
+  if (kernel == nullptr) {
+    const char* name;
+    if (CpuHasAVX2())      { kernel = ParticleKernel_AVX2;   name = "AVX2"; }
+    else if (CpuHasSSE2()) { kernel = ParticleKernel_SSE;    name = "SSE"; }
+    else                   { kernel = ParticleKernel_Scalar; name = "scalar"; }
+    printf("Particle kernel: %s\n", name);
+  }
+  return kernel;
+}
+
+//======================== Benchmark =======
+
+struct ParticleBenchData {
+  std::vector<float> px, py, pz, vx, vy, vz, life, inv_full;
+  void Init(int n) {
+    std::vector<float>* all[] = { &px, &py, &pz, &vx, &vy, &vz, &life, &inv_full };
+    for (std::vector<float>* v : all) v->resize(n);
+    srand(1);
+    for (int i = 0; i < n; i++) {
+      px[i] = py[i] = pz[i] = 0;
+      vx[i] = rand() * 2.0f / RAND_MAX - 1.0f;
+      vy[i] = rand() * 2.0f / RAND_MAX - 1.0f;
+      vz[i] = rand() * 2.0f / RAND_MAX - 1.0f;
+      const float full = 1.0f + rand() * 1.0f / RAND_MAX;
+      life[i] = full;  // 内核本身不删粒子，一直跑下去也没关系
+      inv_full[i] = 1.0f / full;
+    }
+  }
+  ParticleArrays Arrays() {
+    ParticleArrays a = { px.data(), py.data(), pz.data(), vx.data(), vy.data(), vz.data(), life.data(), inv_full.data() };
+    return a;
+  }
+};
+
+int main_particlebench(int argc, char** argv) {
+  struct { const char* name; ParticleKernelFn fn; bool supported; } kernels[] = {
+    { "scalar", ParticleKernel_Scalar, true },
+    { "SSE",    ParticleKernel_SSE,    CpuHasSSE2() },
+    { "AVX2",   ParticleKernel_AVX2,   CpuHasAVX2() },
+  };
+  const int sizes[] = { 1000, 10000, 100000 };
+  const long long updates_per_run = 200000000LL; // 每种情况一共更新这么多个粒子
+  const float secs = SIM_DT, k = SIM_DT * SIM_REF_FPS;
+
+  printf("%-8s %8s %10s %12s %8s\n", "kernel", "n", "ns/update", "us/step", "speedup");
+  for (const int n : sizes) {
+    const int steps = int(updates_per_run / n);
+    ParticleBenchData ref;
+    ref.Init(n);
+    ParticleKernel_Scalar(ref.Arrays(), n, secs, k);
+    double scalar_ns = 0;
+    for (const auto& kern : kernels) {
+      if (!kern.supported) {
+        printf("%-8s %8d %10s\n", kern.name, n, "n/a");
+        continue;
+      }
+      ParticleBenchData d;
+      d.Init(n);
+      // 先比对一步的结果
+      kern.fn(d.Arrays(), n, secs, k);
+      if (memcmp(d.px.data(), ref.px.data(), sizeof(float) * n) ||
+          memcmp(d.life.data(), ref.life.data(), sizeof(float) * n)) {
+        printf("%s: results differ from scalar!\n", kern.name);
+      }
+      const unsigned long long t0 = GetElapsedMicros();
+      for (int s = 0; s < steps; s++) kern.fn(d.Arrays(), n, secs, k);
+      const unsigned long long t1 = GetElapsedMicros();
+      const double ns = (t1 - t0) * 1000.0 / (double(steps) * n);
+      if (kern.fn == ParticleKernel_Scalar) scalar_ns = ns;
+      printf("%-8s %8d %10.3f %12.3f %7.2fx\n", kern.name, n, ns,
+        (t1 - t0) * 1.0 / steps, scalar_ns > 0 ? scalar_ns / ns : 0.0);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _PARTICLEKERNEL_HPP
+#define _PARTICLEKERNEL_HPP
+
+// 粒子积分的内核，ParticlePool::Simulate 用：
+//   s = (lifetime / lifetime_full)^2 * k
+//   pos += vel * s
+//   lifetime -= secs
+// 有标量、SSE、AVX2 三个版本，运行时按 CPUID 选。三个版本的运算顺序相同，结果逐位一致。
+
+struct ParticleArrays {
+  float *pos_x, *pos_y, *pos_z;
+  const float *vel_x, *vel_y, *vel_z;
+  float *lifetime;
+  const float *inv_lifetime_full;
+};
+
+typedef void (*ParticleKernelFn)(const ParticleArrays& a, int n, float secs, float k);
+
+void ParticleKernel_Scalar(const ParticleArrays& a, int n, float secs, float k);
+void ParticleKernel_SSE(const ParticleArrays& a, int n, float secs, float k);
+void ParticleKernel_AVX2(const ParticleArrays& a, int n, float secs, float k);
+
+bool CpuHasSSE2();
+bool CpuHasAVX2();
+ParticleKernelFn GetParticleKernel(); // 第一次调用时选好并打印
+
+// cyclimb particlebench：各个版本在 1k/10k/100k 个粒子时的耗时
+int main_particlebench(int argc, char** argv);
+
+#endif
@@ -0,0 +1,165 @@
+#include "profiler.hpp"
+#include "textrender.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <mutex>
+#include <algorithm>
+
+extern int WIN_W, WIN_H;
+
+bool Profiler::enabled = false;
+std::vector<Profiler::Stat> Profiler::stats;
+
+static std::mutex g_profiler_mutex;
+static std::vector<Profiler::ThreadBuffer*> g_profiler_buffers; // 所有线程的
+static thread_local Profiler::ThreadBuffer* t_profiler_buffer = nullptr;
+static Profiler::ThreadBuffer* g_profiler_main_buffer = nullptr;
+static unsigned long long g_profiler_frame_begin = 0; // 本帧第一个事件在主线程缓冲里的序号
+static unsigned long long g_profiler_frame_t0 = 0;
+
+Profiler::ThreadBuffer* Profiler::GetThreadBuffer() {
+  if (t_profiler_buffer == nullptr) {
+    ThreadBuffer* b = new ThreadBuffer();
+    b->count = 0;
+    b->depth = 0;
+    std::lock_guard<std::mutex> lock(g_profiler_mutex);
+    b->tid = int(g_profiler_buffers.size());
+    g_profiler_buffers.push_back(b);
+    t_profiler_buffer = b;
+  }
+  return t_profiler_buffer;
+}
+
+void ScopedTimer::Begin() {
+  Profiler::GetThreadBuffer()->depth++;
+  t0 = GetElapsedMicros();
+}
+
+void ScopedTimer::End() {
+  const unsigned long long t1 = GetElapsedMicros();
+  Profiler::ThreadBuffer* b = Profiler::GetThreadBuffer();
+  b->depth--;
+  const unsigned long long n = b->count.load(std::memory_order_relaxed);
+  ProfileEvent& e = b->events[n % Profiler::ThreadBuffer::CAPACITY];
+  e.name = name;
+  e.t0 = t0;
+  e.t1 = t1;
+  e.depth = b->depth;
+  b->count.store(n + 1, std::memory_order_release);
+}
+
+void Profiler::AddSample(const char* name, float ms, bool is_gpu) {
+  for (Stat& s : stats) {
+    if (s.is_gpu == is_gpu && (s.name == name || !strcmp(s.name, name))) {
+      s.accum_ms += ms;
+      return;
+    }
+  }
+  Stat s;
+  s.name = name;
+  s.is_gpu = is_gpu;
+  s.last_ms = s.avg_ms = s.max_ms = 0;
+  s.accum_ms = ms;
+  stats.push_back(s);
+}
+
+void Profiler::Toggle() {
+  enabled = !enabled;
+  stats.clear();
+  g_profiler_frame_t0 = 0;
+  printf("Profiler %s\n", enabled ? "on" : "off");
+}
+
+void Profiler::NewFrame() {
+  if (!enabled) return;
+  ThreadBuffer* b = GetThreadBuffer();
+  if (g_profiler_main_buffer != b) {
+    g_profiler_main_buffer = b;
+    g_profiler_frame_begin = b->count;
+  }
+
+  // 把上一帧的事件汇总进统计里
+  unsigned long long first = g_profiler_frame_begin;
+  if (b->count - first > ThreadBuffer::CAPACITY) {
+    first = b->count - ThreadBuffer::CAPACITY;
+  }
+  for (unsigned long long i = first; i < b->count; i++) {
+    const ProfileEvent& e = b->events[i % ThreadBuffer::CAPACITY];
+    AddSample(e.name, (e.t1 - e.t0) * 0.001f);
+  }
+  g_profiler_frame_begin = b->count;
+
+  const unsigned long long t = GetElapsedMicros();
+  if (g_profiler_frame_t0 != 0) {
+    AddSample("frame", (t - g_profiler_frame_t0) * 0.001f);
+  }
+  g_profiler_frame_t0 = t;
+
+  for (Stat& s : stats) {
+    s.last_ms = s.accum_ms;
+    s.avg_ms = s.avg_ms * 0.95f + s.last_ms * 0.05f;
+    s.max_ms = s.max_ms * 0.99f;
+    if (s.last_ms > s.max_ms) s.max_ms = s.last_ms;
+    s.accum_ms = 0;
+  }
+}
+
+void Profiler::RenderOverlay(GraphicsAPI api) {
+  if (!enabled) return;
+  const glm::mat4 uitransform(1);
+  const float x = WIN_W - 380.0f, scale = 0.6f, line_height = 18.0f;
+  float y = 32.0f;
+  RenderText(api, L"        last    avg    max (ms)", x, y, scale,
+    glm::vec3(1.0f, 1.0f, 1.0f), uitransform);
+  y += line_height;
+  wchar_t buf[100];
+  for (const Stat& s : stats) {
+    std::wstring name(s.name, s.name + strlen(s.name));
+    swprintf(buf, 100, L"%6.2f %6.2f %6.2f  ", s.last_ms, s.avg_ms, s.max_ms);
+    std::wstring text = std::wstring(s.is_gpu ? L"GPU " : L"CPU ") + buf + name;
+    glm::vec3 color = s.is_gpu ? glm::vec3(0.2f, 1.0f, 1.0f) : glm::vec3(1.0f, 1.0f, 0.2f);
+    RenderText(api, text, x, y, scale, color, uitransform);
+    y += line_height;
+  }
+}
+
+bool Profiler::DumpChromeTrace(const char* fn) {
+  FILE* f = fopen(fn, "w");
+  if (!f) {
+    printf("Could not open %s for writing\n", fn);
+    return false;
+  }
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  int num_events = 0;
+  std::lock_guard<std::mutex> lock(g_profiler_mutex);
+  std::vector<ProfileEvent> events;
+  for (ThreadBuffer* b : g_profiler_buffers) {
+    // 后台线程（字形光栅化等）可能还在写：只拷到 acquire 读到的 count，
+    // 拷完再读一次，这期间被环形缓冲覆盖掉的（包括正在写的那一个）旧事件扔掉
+    const unsigned long long count = b->count.load(std::memory_order_acquire);
+    unsigned long long i0 = 0;
+    if (count > ThreadBuffer::CAPACITY) i0 = count - ThreadBuffer::CAPACITY;
+    events.clear();
+    for (unsigned long long i = i0; i < count; i++) {
+      events.push_back(b->events[i % ThreadBuffer::CAPACITY]);
+    }
+    const unsigned long long limit = b->count.load(std::memory_order_acquire) + 1;
+    size_t skip = 0;
+    if (limit > ThreadBuffer::CAPACITY && limit - ThreadBuffer::CAPACITY > i0) {
+      skip = size_t(std::min(limit - ThreadBuffer::CAPACITY - i0, (unsigned long long)events.size()));
+    }
+    for (size_t i = skip; i < events.size(); i++) {
+      const ProfileEvent& e = events[i];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%d}",
+        first ? "" : ",\n", e.name, e.t0, e.t1 - e.t0, b->tid);
+      first = false;
+      num_events++;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  printf("Dumped %d profiler events to %s\n", num_events, fn);
+  return true;
+}
@@ -0,0 +1,72 @@
+#ifndef _PROFILER_HPP
+#define _PROFILER_HPP
+
+#include "util.hpp"
+#include <vector>
+#include <atomic>
+
+// 简易的分段计时器
+//
+//   { PROFILE_SCOPE("depth pass"); ... }
+//
+// 没打开时每个计时点只多一次判断。事件记在每个线程自己的环形缓冲里，不加锁；
+// 叠加层上的统计只汇总主线程（调用 NewFrame 的线程）的事件。
+// 可以导出成 Chrome trace（chrome://tracing 或 ui.perfetto.dev 打开）。
+
+struct ProfileEvent {
+  const char* name;          // 只存指针，必须是字面常量
+  unsigned long long t0, t1; // 微秒
+  int depth;
+};
+
+class Profiler {
+public:
+  static bool enabled;
+
+  struct ThreadBuffer {
+    static const int CAPACITY = 16384;
+    ProfileEvent events[CAPACITY];
+    // 一共写过多少个，取模即为写入位置。只有本线程写；先写事件再 release，
+    // 别的线程（DumpChromeTrace）acquire 读到的数以内的事件都是写完的
+    std::atomic<unsigned long long> count;
+    int tid, depth;
+  };
+  static ThreadBuffer* GetThreadBuffer();
+
+  // 叠加层上显示的统计，GPU 计时也往这里送
+  struct Stat {
+    const char* name;
+    bool is_gpu;
+    float last_ms, avg_ms, max_ms;
+    float accum_ms;
+  };
+  static std::vector<Stat> stats;
+  static void AddSample(const char* name, float ms, bool is_gpu = false);
+
+  static void Toggle();
+  static void NewFrame();  // 每帧开始时调用
+  static void RenderOverlay(GraphicsAPI api);
+  static bool DumpChromeTrace(const char* fn);
+};
+
+class ScopedTimer {
+public:
+  ScopedTimer(const char* _name) : name(_name), active(Profiler::enabled) {
+    if (active) Begin();
+  }
+  ~ScopedTimer() {
+    if (active) End();
+  }
+private:
+  void Begin();
+  void End();
+  const char* name;
+  bool active;
+  unsigned long long t0;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(_scoped_timer_, __LINE__)(name)
+
+#endif
@@ -16,18 +16,16 @@ MsaaFBO::MsaaFBO(const int _w, const int _h, const int samples) {
   glGenFramebuffers(1, &fbo);
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-  GLuint ms_tex;
   glGenTextures(1, &tex);
   glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex);
   glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples,
-      GL_RGBA, width, height, GL_TRUE);
+      GL_RGBA8, width, height, GL_TRUE); // 和默认帧缓冲一样是 RGBA8，直接 resolve 到窗口才保证可以
 
-  GLuint db;
-  glGenRenderbuffers(1, &db);
-  glBindRenderbuffer(GL_RENDERBUFFER, db);
+  glGenRenderbuffers(1, &depth_rb);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
   glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
       GL_DEPTH_COMPONENT, width, height);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, db);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, tex, 0);
 
   GLenum rts[1] = { GL_COLOR_ATTACHMENT0 };
@@ -44,12 +42,45 @@ MsaaFBO::MsaaFBO(const int _w, const int _h, const int samples) {
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+MsaaFBO::~MsaaFBO() {
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &tex);
+  glDeleteRenderbuffers(1, &depth_rb);
+}
+
 void MsaaFBO::BlitTo(BasicFBO* x) {
+  BlitTo(x, width, height);
+}
+
+void MsaaFBO::BlitTo(BasicFBO* x, int w, int h) {
   glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, x->fbo);
+  glBlitFramebuffer(0, 0, w, h, 0, 0, w, h,
+      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void MsaaFBO::BlitToDefault() {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
   glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
       GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+BasicFBO::~BasicFBO() {
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &tex);
+  glDeleteTextures(1, &depth_tex);
+}
+
+// 单采样的可以缩放，用线性过滤
+void BasicFBO::UpscaleToDefault(int w, int h, int dst_w, int dst_h) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, w, h, 0, 0, dst_w, dst_h,
+      GL_COLOR_BUFFER_BIT, GL_LINEAR);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
@@ -61,8 +92,8 @@ BasicFBO::BasicFBO(const int _w, const int _h) {
 
   glGenTextures(1, &tex);
   glBindTexture(GL_TEXTURE_2D, tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-      width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+      width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
@@ -108,12 +139,15 @@ DepthOnlyFBO::DepthOnlyFBO(const int _w, const int _h) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  // 用 sampler2DShadow 采样，硬件做比较和双线性 PCF
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 
   glGenFramebuffers(1, &fbo);
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
-  //glDrawBuffer(GL_NONE);
-  //glReadBuffer(GL_NONE);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
   MyCheckGLError("create depth fbo");
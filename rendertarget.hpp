@@ -2,7 +2,11 @@
 #define _RENDERTARGET_HPP_
 
 #define GLM_FORCE_RADIANS
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -20,12 +24,19 @@ public:
 class MsaaFBO : public FBO {
 public:
   MsaaFBO(const int _w, const int _h, const int samples);
+  ~MsaaFBO();
   void BlitTo(BasicFBO* x);
+  void BlitTo(BasicFBO* x, int w, int h); // 只 resolve 左下角 w x h
+  void BlitToDefault(); // 直接 resolve 到窗口的 framebuffer
+  GLuint depth_rb;
 };
 
 class BasicFBO : public FBO {
 public:
   BasicFBO(const int _w, const int _h);
+  ~BasicFBO();
+  // 左下角 w x h 拉伸到窗口的 dst_w x dst_h（动态分辨率）
+  void UpscaleToDefault(int w, int h, int dst_w, int dst_h);
   GLuint depth_tex;
 };
 
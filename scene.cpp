@@ -3,6 +3,7 @@
 #include "game.hpp"
 #include "sounds.hpp"
 #include "util.hpp"
+#include "profiler.hpp"
 #define _USE_MATH_DEFINES // For MSVC
 #include <math.h>
 #include <assert.h>
@@ -15,6 +16,7 @@ extern ID3D11DeviceContext* g_context11;
 
 extern unsigned g_fadein_complete_millis;
 extern unsigned g_last_millis;
+extern float g_sim_alpha;
 extern char g_arrow_dx, g_arrow_dy;
 
 extern Particles* GetGlobalParticles();
@@ -108,6 +110,8 @@ void ClimbScene::InitStatic() {
   model_backgrounds1.push_back(new ChunkGrid("climb/bg1_2.vox"));
   model_backgrounds2.push_back(new ChunkGrid("climb/bg2.vox"));
   model_backgrounds2.push_back(new ChunkGrid("climb/bg2_2.vox"));
+  for (ChunkGrid* g : model_backgrounds1) g->EnableLOD();
+  for (ChunkGrid* g : model_backgrounds2) g->EnableLOD();
   model_coin = new ChunkGrid("climb/coin.vox");
   model_exit = new ChunkGrid("climb/goal.vox");
 
@@ -129,86 +133,211 @@ void ClimbScene::InitStatic() {
   }
 }
 
-void ClimbScene::PreRender() { }
+// 在上一步和当前步之间插值，画完之后在 PostRender 里恢复
+void ClimbScene::PreRender() {
+  player_pos_sim = player->pos;
+  camera_pos_sim = camera->pos;
+  if (game_state != ClimbGameStateInEditing) {
+    player->pos = glm::mix(player_pos_prev, player_pos_sim, g_sim_alpha);
+    camera->pos = glm::mix(camera_pos_prev, camera_pos_sim, g_sim_alpha);
+  }
+}
 
-void ClimbScene::PrepareSpriteListForRender() {
-  // 在此处理删除掉的coins和platforms
-  std::vector<Platform*> platforms1;
-  std::vector<Sprite*> coins1;
-  for (Platform* p : platforms) {
-    if (p->marked_for_removal == true) {
-    }
-    else {
-      platforms1.push_back(p);
-    }
+void ClimbScene::PostRender() {
+  player->pos = player_pos_sim;
+  camera->pos = camera_pos_sim;
+}
+
+void ClimbScene::BeginStep() {
+  player_pos_prev = player->pos;
+  camera_pos_prev = camera->pos;
+}
+
+void ClimbScene::AddPlatform(Platform* p) {
+  p->scene_idx = int(platforms.size());
+  platforms.push_back(p);
+  render_list_dirty = true;
+}
+
+void ClimbScene::RemovePlatform(Platform* p) {
+  const int idx = p->scene_idx;
+  assert(idx >= 0 && idx < int(platforms.size()) && platforms[idx] == p);
+  platforms[idx] = platforms.back();
+  platforms[idx]->scene_idx = idx;
+  platforms.pop_back();
+  p->scene_idx = -1;
+  if (p == exit_platform) exit_platform = nullptr;
+  render_list_dirty = true;
+}
+
+void ClimbScene::AddCoin(Sprite* c) {
+  coins.push_back(c);
+  render_list_dirty = true;
+}
+
+void ClimbScene::RemoveCoinAt(int idx) {
+  coins[idx] = coins.back();
+  coins.pop_back();
+  render_list_dirty = true;
+}
+
+void ClimbScene::ClearObjects() {
+  for (Platform* p : platforms) p->scene_idx = -1;
+  // 先放掉旧的缓冲再 Reset
+  platforms = PlatformList(ArenaAllocator<Platform*>(&level_arena));
+  coins = SpriteList(ArenaAllocator<Sprite*>(&level_arena));
+  initial_coins = SpriteList(ArenaAllocator<Sprite*>(&level_arena));
+  level_arena.Reset();
+  exit_platform = nullptr;
+  normal_platform_pool.ReleaseAll();
+  damagable_platform_pool.ReleaseAll();
+  exit_platform_pool.ReleaseAll();
+  coin_pool.ReleaseAll();
+  render_list_dirty = true;
+}
+
+void ClimbScene::Platform::Reset(const glm::vec3& p) {
+  ChunkSprite* cs = (ChunkSprite*)(sprite);
+  cs->Init();
+  cs->pos = p;
+  cs->vel = cs->omega = glm::vec3(0, 0, 0);
+}
+
+// 被打坏了才需要把体素复制回来
+void ClimbScene::DamagablePlatform::Reset(const glm::vec3& p) {
+  Platform::Reset(p);
+  if (damaged) {
+    ((ChunkGrid*)(((ChunkSprite*)sprite)->chunk))->CopyVoxelsFrom(*model);
+    damaged = false;
   }
-  for (Sprite* c : coins) {
-    if (c->marked_for_removal == true) {
-    }
-    else {
-      coins1.push_back(c);
+}
+
+void ClimbScene::ExitPlatform::Reset(const glm::vec3& p) {
+  Platform::Reset(p);
+  state = Hidden;
+  fly_in_end_millis = 0;
+}
+
+ClimbScene::NormalPlatform* ClimbScene::NewNormalPlatform(const glm::vec3& p) {
+  NormalPlatform* x = normal_platform_pool.Get();
+  if (x == nullptr) {
+    x = normal_platform_pool.Add(new NormalPlatform(new ChunkSprite(model_platforms[0])));
+  }
+  x->Reset(p);
+  return x;
+}
+
+ClimbScene::DamagablePlatform* ClimbScene::NewDamagablePlatform(const glm::vec3& p) {
+  DamagablePlatform* x = damagable_platform_pool.Get();
+  if (x == nullptr) {
+    x = damagable_platform_pool.Add(new DamagablePlatform(new ChunkSprite(model_platforms[1])));
+  }
+  x->Reset(p);
+  return x;
+}
+
+ClimbScene::ExitPlatform* ClimbScene::NewExitPlatform(const glm::vec3& p) {
+  ExitPlatform* x = exit_platform_pool.Get();
+  if (x == nullptr) {
+    x = exit_platform_pool.Add(new ExitPlatform(new ChunkSprite(model_exit)));
+  }
+  x->Reset(p);
+  return x;
+}
+
+ChunkSprite* ClimbScene::NewCoin(const glm::vec3& p) {
+  ChunkSprite* x = coin_pool.Get();
+  if (x == nullptr) {
+    x = coin_pool.Add(new ChunkSprite(model_coin));
+  }
+  x->Init();
+  x->pos = p;
+  x->vel = x->omega = glm::vec3(0, 0, 0);
+  return x;
+}
+
+// 只在编辑模式下调用
+bool ClimbScene::UpdateEditModeHover() {
+  if (is_dragging && dragged_sprite) {
+    static_shadow_version++;
+    glm::vec3 drag_delta = WindowCoordToGamePlane(camera, mouse_x, mouse_y) - drag_pos0;
+    dragged_sprite->pos = dragged_sprite_pos0 + drag_delta;
+    if (is_shift_down) {
+      dragged_sprite->pos.x = int(dragged_sprite->pos.x);
+      dragged_sprite->pos.y = int(dragged_sprite->pos.y);
     }
   }
-  platforms = platforms1;
-  coins = coins1;
 
-  sprite_render_list.clear();
   bool should_add_hl = false;
   glm::vec3 campos = camera->pos;
   campos.z = 0;
-  hovered_sprite = nullptr;
+  const glm::vec3 pickray_dir = WindowCoordToPickRayDir(camera, mouse_x, mouse_y);
+  const glm::vec3 pickray_orig = camera->pos;
   for (Platform* p : platforms) {
     Sprite* sp = p->GetSpriteForDisplay();
-    if (this->game_state == ClimbGameStateInEditing && 
-        sp != nullptr &&
-        curr_edit_option == 0) {
-      ChunkSprite* csp = dynamic_cast<ChunkSprite*>(sp);
-
-      if (is_dragging && dragged_sprite) {
-        glm::vec3 drag_delta = WindowCoordToGamePlane(camera, mouse_x, mouse_y) - drag_pos0;
-        dragged_sprite->pos = dragged_sprite_pos0 + drag_delta;
-        if (is_shift_down) {
-          dragged_sprite->pos.x = int(dragged_sprite->pos.x);
-          dragged_sprite->pos.y = int(dragged_sprite->pos.y);
-        }
-      }
+    if (sp == nullptr) continue;
+    ChunkSprite* csp = (ChunkSprite*)(sp);  // 平台都是 ChunkSprite
+    AABB aabb = csp->GetAABBInWorld();
 
-      if (csp) {
-        AABB aabb = csp->GetAABBInWorld();
+    bool x1 = (campos.x >= aabb.lb.x && campos.x <= aabb.ub.x &&
+      campos.y >= aabb.lb.y && campos.y <= aabb.ub.y);
+    bool x2 = aabb.IntersectRay(pickray_orig, pickray_dir);
 
-        glm::vec3 pickray_dir = WindowCoordToPickRayDir(camera, mouse_x, mouse_y);
-        glm::vec3 pickray_orig = camera->pos;
+    if (x2) {
+      hovered_sprite = csp;
+    }
 
-        bool x1 = (campos.x >= aabb.lb.x && campos.x <= aabb.ub.x &&
-          campos.y >= aabb.lb.y && campos.y <= aabb.ub.y);
-        bool x2 = aabb.IntersectRay(pickray_orig, pickray_dir);
+    if (x1 || x2) {
+      highlight_sprite->pos = sp->pos;
+      float phase = fabs(sin(light_phase * 4));
+      highlight_sprite->scale.x = (aabb.ub.x - aabb.lb.x) + phase + 1;
+      highlight_sprite->scale.y = (aabb.ub.y - aabb.lb.y) + phase + 1;
+      highlight_sprite->scale.z = (aabb.ub.z - aabb.lb.z) + phase + 1;
+      should_add_hl = true;
+    }
+  }
+  return should_add_hl;
+}
 
-        if (x2) {
-          hovered_sprite = csp;
-        }
+void ClimbScene::PrepareSpriteListForRender() {
+  PROFILE_SCOPE("PrepareSpriteListForRender");
+  const unsigned long long t0 = GetElapsedMicros();
+
+  // 背景跟着镜头挪，换格子的时候才重新摆
+  int x_tick, y_tick;
+  GetBackgroundTicks(&x_tick, &y_tick);
+  if (x_tick != bg_tick_x || y_tick != bg_tick_y) {
+    render_list_dirty = true;
+  }
 
-        if (x1 || x2) {
-          highlight_sprite->pos = sp->pos;
-          float phase = fabs(sin(light_phase * 4));
-          highlight_sprite->scale.x = (aabb.ub.x - aabb.lb.x) + phase + 1;
-          highlight_sprite->scale.y = (aabb.ub.y - aabb.lb.y) + phase + 1;
-          highlight_sprite->scale.z = (aabb.ub.z - aabb.lb.z) + phase + 1;
-          should_add_hl = true;
-        }
-      }
+  // 平台、背景、硬币、玩家：只在增删物件或背景换格子时重建
+  if (render_list_dirty) {
+    sprite_render_list.clear();
+    for (Platform* p : platforms) {
+      Sprite* sp = p->GetSpriteForDisplay();
+      if (sp) sprite_render_list.push_back(sp);
     }
-    sprite_render_list.push_back(sp);
-  }
-  if (should_add_hl) {
-    sprite_render_list.push_back(highlight_sprite);
+    LayoutBackground();
+    num_static_sprites = int(sprite_render_list.size());
+    static_shadow_version++;
+    for (Sprite* s : coins) {
+      sprite_render_list.push_back(s);
+    }
+    sprite_render_list.push_back(player);
+    num_retained_sprites = int(sprite_render_list.size());
+    render_list_dirty = false;
   }
 
-  for (Sprite* s : coins) {
-    sprite_render_list.push_back(s);
+  // 后面每帧都变的部分，容量留着，不会再分配
+  sprite_render_list.resize(num_retained_sprites);
+
+  hovered_sprite = nullptr;
+  if (game_state == ClimbGameStateInEditing && curr_edit_option == 0) {
+    if (UpdateEditModeHover()) {
+      sprite_render_list.push_back(highlight_sprite);
+    }
   }
-  sprite_render_list.push_back(player);
-  LayoutBackground();
-  
+
   if ((rope_state == Anchored) || (rope_state == Probing)) {
     const int N = int(rope_segments.size());
     for (int i=0; i<N; i++) {
@@ -223,8 +352,8 @@ void ClimbScene::PrepareSpriteListForRender() {
   
   // Particle
   Particles* particles = GetGlobalParticles();
-  for (int i=0; i<particles->particles.size(); i++) {
-    sprite_render_list.push_back(particles->particles[i].sprite);
+  for (ParticlePool* pool : particles->pools) {
+    if (pool->count > 0) sprite_render_list.push_back(pool);
   }
 
   // Edit mode
@@ -233,18 +362,30 @@ void ClimbScene::PrepareSpriteListForRender() {
     if (c)
       sprite_render_list.push_back(c);
   }
+
+  phase_times.render_list += GetElapsedMicros() - t0;
 }
 
 std::vector<Sprite*>* ClimbScene::GetSpriteListForRender() {
   return &sprite_render_list;
 }
 
-ClimbScene::ClimbScene() {
+ClimbScene::ClimbScene() :
+  platforms(ArenaAllocator<Platform*>(&level_arena)),
+  coins(ArenaAllocator<Sprite*>(&level_arena)),
+  initial_coins(ArenaAllocator<Sprite*>(&level_arena)) {
   lights[0] = new DirectionalLight(glm::vec3(1, -1, 0), glm::vec3(-100, 200, 0), glm::vec3(1, 0, 0), 15 * 3.14159f / 180.0f);
   lights[1] = new DirectionalLight(glm::vec3(-1, -1, 0), glm::vec3(100, 200, 0), glm::vec3(1, 0, 0), 15 * 3.14159f / 180.0f);
   lights[2] = new DirectionalLight(glm::vec3(0, -1, 0), glm::vec3(0, 200, 0), glm::vec3(1, 0, 0), 15 * 3.14159f / 180.0f);
   is_test_playing = false;
   curr_edit_option = 0;
+  exit_platform = nullptr;
+  backgrounds0 = backgrounds1 = nullptr;
+  render_list_dirty = true;
+  num_retained_sprites = 0;
+  num_static_sprites = 0;
+  static_shadow_version = 0;
+  bg_tick_x = bg_tick_y = 0x7fffffff;
 }
 
 void ClimbScene::Init() {
@@ -255,6 +396,7 @@ void ClimbScene::Init() {
   camera->pos = glm::vec3(0, 0, 200);
   camera->lookdir = glm::vec3(0, 0, -1);
   camera->up = glm::vec3(0, 1, 0);
+  camera_pos_prev = camera->pos;
   
   // Player sprite
   player      = new ChunkSprite(model_char);
@@ -361,7 +503,8 @@ void ClimbScene::Update(float secs) {
         }
         float probe_completion = 1.0f - probe_remaining_millis / PROBE_DURATION;
         bool probing = ((probe_completion > 0 || is_key_pressed) && (rope_state == Probing));
-            
+        
+        const unsigned long long t_probe = GetElapsedMicros();
         if (probing) {
           if (probe_completion >= 1) {
             HideRope();
@@ -378,7 +521,7 @@ void ClimbScene::Update(float secs) {
                 if (is_key_pressed && // 只有按着键，才会钩上
                   sp != nullptr && sp->IntersectPoint(x)) {
                   CyclimbSound snd = CyclimbSound::Tap;
-                  if (dynamic_cast<ExitPlatform*>(platforms[i])) {
+                  if (platforms[i] == exit_platform) {
                     BeginLevelCompleteSequence();
                     snd = CyclimbSound::Whistle;
                   }
@@ -412,6 +555,7 @@ void ClimbScene::Update(float secs) {
           }
         DONE: { }
         }
+        phase_times.probe += GetElapsedMicros() - t_probe;
         
         if (should_step) {
           if (rope_state == Anchored) {
@@ -430,23 +574,24 @@ void ClimbScene::Update(float secs) {
               }
 
               player->vel += acc * secs;
-              player->vel.x *= X_VEL_DAMP;
-              player->vel.y *= Y_VEL_DAMP;
+              player->vel.x *= powf(X_VEL_DAMP, secs * SIM_REF_FPS);
+              player->vel.y *= powf(Y_VEL_DAMP, secs * SIM_REF_FPS);
             }
           }
         
           {
-            player->omega *= 0.99f;
+            player->omega *= powf(0.99f, secs * SIM_REF_FPS);
           }
         }
         
         // Intersect coin
+        const unsigned long long t_collision = GetElapsedMicros();
         if (is_all_rockets_collected == false) {
           glm::vec3 p = GetPlayerEffectivePos();
-          std::vector<Sprite*> next_coins;
-          for (Sprite* c : coins) {
-            if (c->IntersectPoint(p, 5)) { // Intersecting
+          for (int i = 0; i < int(coins.size()); ) {
+            if (coins[i]->IntersectPoint(p, 5)) { // Intersecting
               num_coins --;
+              RemoveCoinAt(i);
               
               if (num_coins <= 0) {
                 printf("num_coins <= 0\n");
@@ -454,11 +599,11 @@ void ClimbScene::Update(float secs) {
               }
               
             } else {
-              next_coins.push_back(c);
+              i++;
             }
           }
-          coins = next_coins;
         }
+        phase_times.collision += GetElapsedMicros() - t_collision;
         
         // 只有在还有剩余时才转
         if (num_coins > 0)
@@ -467,13 +612,13 @@ void ClimbScene::Update(float secs) {
         // 无论何时都会转
         CameraFollow(secs);
         if (should_step) {
-          GetGlobalParticles()->Update(secs);
+          UpdateParticles(secs);
         }
         light_phase += secs;
       }
       break;
     case ClimbGameStateStartCountdown: {
-      GetGlobalParticles()->Update(secs);
+      UpdateParticles(secs);
       CameraFollow(secs);
       if (countdown_millis <= 0) {
         SetGameState(ClimbGameStateInGame);
@@ -482,7 +627,7 @@ void ClimbScene::Update(float secs) {
     }
     case ClimbGameStateLevelFinishSequence: {
         
-      GetGlobalParticles()->Update(secs);
+      UpdateParticles(secs);
       CameraFollow(secs);
       
       float completion = level_finish_state.GetCompletion();
@@ -497,28 +642,28 @@ void ClimbScene::Update(float secs) {
       break;
     }
     case ClimbGameStateLevelEndWaitKey: {
-      unsigned millis = GetElapsedMillis();
+      unsigned millis = GetSimulationMillis();
       int period = int(millis / LEVEL_FINISH_JUMP_PERIOD);
       float phase = (millis - period * LEVEL_FINISH_JUMP_PERIOD) * 1.0f / LEVEL_FINISH_JUMP_PERIOD;
       player->pos = level_finish_state.pos0 + glm::vec3(0, 4*sinf(M_PI*phase), 0);
       
       // Rockets fly
       for (Sprite* s : coins) {
-        s->pos += s->vel;
-        if (rand() * 1.0f / RAND_MAX < 1.0f / 6) {
+        s->pos += s->vel * (secs * SIM_REF_FPS);
+        if (rand() * 1.0f / RAND_MAX < (1.0f / 6) * (secs * SIM_REF_FPS)) { // 原来每帧 1/6
           GetGlobalParticles()->SpawnDefaultSprite(s->pos,
             0.6f,
             0.6f);
         }
         s->vel += glm::vec3(0, 2.0f * secs, 0);
       }
-      GetGlobalParticles()->Update(secs);
+      UpdateParticles(secs);
       break;
     }
     case ClimbGameStateInEditing: {
       for (int i = 0; i < 9; i++) {
         if (keyflags.test(i)) {
-          camera->pos += kDirs[i];
+          camera->pos += kDirs[i] * (secs * SIM_REF_FPS);
         }
       }
       for (int i = 0; i < cursor_sprites.size(); i++) {
@@ -534,6 +679,11 @@ void ClimbScene::Update(float secs) {
   for (Platform* p : platforms) p->Update(secs);
 }
 
+// 和 do_RenderHUD 里的字保持一致
+void ClimbScene::PrewarmGlyphs() {
+  PrewarmText(L"准备… 第关 关卡 完成！ 时间: 秒 请按 [空格] 继续 个平台 硬币 /0123456789.s");
+}
+
 void ClimbScene::do_RenderHUD(GraphicsAPI api) {
   glm::mat4 uitransform(1);
 
@@ -569,8 +719,7 @@ void ClimbScene::do_RenderHUD(GraphicsAPI api) {
       glm::vec3(1.0f, 1.0f, 0.2f),
       uitransform);
 
-    swprintf(buf, 50, L"请按 [空格] 继续");
-    text = std::wstring(buf);
+    text = L"请按 [空格] 继续";
     MeasureTextWidth(text, &width);
 
     RenderText(api, text, WIN_W / 2 - width / 2, WIN_H / 2 + 96, 0.8f,
@@ -611,11 +760,12 @@ void ClimbScene::do_RenderHUD(GraphicsAPI api) {
     }
   }
 
-  std::wstring text(buf);
+  std::wstring text;
   const float scale = 0.8f;
   if (show_coin_count) {
     // 金币数
-    swprintf(buf, 20, L"硬币 %d/%d %.1fs", num_coins, num_coins_total, curr_level_time);
+    swprintf(buf, 50, L"硬币 %d/%d %.1fs", num_coins, num_coins_total, curr_level_time);
+    text = std::wstring(buf);
     RenderText(api, text, 32, 32, scale, glm::vec3(1.0f, 1.0f, 0.2f), uitransform);
   }
 
@@ -665,22 +815,16 @@ void ClimbScene::OnKeyPressed(char k) {
       const float x = camera->pos.x, y = camera->pos.y;
       switch (curr_edit_option) {
       case 1: {
-        ChunkSprite* s = new ChunkSprite(model_platforms[0]);
-        s->pos = glm::vec3(x, y, 0);
-        platforms.push_back(new NormalPlatform(s));
+        AddPlatform(NewNormalPlatform(glm::vec3(x, y, 0)));
         break;
       }
       case 2: {
-        ChunkSprite* s = new ChunkSprite(model_platforms[1]);
-        s->pos = glm::vec3(x, y, 0);
-        platforms.push_back(new DamagablePlatform(s));
+        AddPlatform(NewDamagablePlatform(glm::vec3(x, y, 0)));
         break;
       }
       case 3:
       {
-        ChunkSprite* s = new ChunkSprite(model_coin);
-        s->pos = glm::vec3(x, y, 0);
-        coins.push_back(s);
+        AddCoin(NewCoin(glm::vec3(x, y, 0)));
         break;
       }
       default: break;
@@ -689,9 +833,11 @@ void ClimbScene::OnKeyPressed(char k) {
     else if (k == 'p') {
       DumpCurrentLevelToText();
     }
+#ifdef WIN32
     else if (k == VK_SHIFT) {
       is_shift_down = true;
     }
+#endif
   }
 
   if (k == 'g') { 
@@ -746,7 +892,7 @@ void ClimbScene::OnKeyPressed(char k) {
         }
         
       } else {
-        printf("STARTPROBE, k=%c\n", k);
+        if (g_debug) printf("STARTPROBE, k=%c\n", k);
         MyPlaySound(CyclimbSound::Whoosh);
         is_key_pressed = true;
         rope_state = Probing;
@@ -788,7 +934,7 @@ void ClimbScene::OnKeyReleased(char k) {
         if (rope_state == Anchored) {
           
           if (k == 'a' || k == 'd') player_x_thrust = 0; // 荡秋千
-          printf("AnchorLevels %d->%d\n", anchor_levels, anchor_levels-1);
+          if (g_debug) printf("AnchorLevels %d->%d\n", anchor_levels, anchor_levels-1);
           anchor_levels --;
           if (anchor_levels <= 0) {
             anchor_levels = 0;
@@ -804,9 +950,11 @@ void ClimbScene::OnKeyReleased(char k) {
     for (int i = 0; i < 9; i++) {
       if (keys[i] == k) { keyflags.reset(i); break; }
     }
+#ifdef WIN32
     if (k == VK_SHIFT) {
       is_shift_down = false;
     }
+#endif
   }
 }
 
@@ -815,6 +963,7 @@ void ClimbScene::SpawnPlayer() {
   player->vel = GetPlayerInitVel();
   player->orientation = glm::mat3(1);
   player->omega = glm::vec3(0);
+  player_pos_prev = player->pos; // 瞬移，不插值
   HideRope();
   keyflags.reset();
 }
@@ -843,7 +992,6 @@ glm::vec3 ClimbScene::GetPlayerEffectiveRopeEndpoint() {
 void ClimbScene::SetAnchorPoint(glm::vec3 anchor_p, glm::vec3 anchor_dir) {
   anchor_rope_endpoint = anchor_p - glm::normalize(anchor_dir) * ANCHOR_LEN;
   anchor->pos = anchor_p;
-  printf("[SetAnchorPoint]\n");
 }
 
 void ClimbScene::LoadLevelData() {
@@ -882,37 +1030,30 @@ void ClimbScene::do_StartLevel(LevelData& ldata) {
   num_coins = num_coins_total = 0;
 
   // 删除物件
-  for (Platform* s : platforms) { s->marked_for_removal = true; }
-  for (Sprite* c : coins) { c->marked_for_removal = true; }
-  coins.clear();
-  platforms.clear();
+  ClearObjects();
   GetGlobalParticles()->DeleteAll();
+  platforms.reserve(ldata.entries.size());
+  coins.reserve(ldata.entries.size());
 
-  for (LevelData::PlatformEntry entry : ldata.entries) {
+  for (const LevelData::PlatformEntry& entry : ldata.entries) {
+    const glm::vec3 p(entry.x, entry.y, 0);
     if (entry.tag == "plat0") {
-      ChunkSprite* s = new ChunkSprite(model_platforms[0]);
-      s->pos = glm::vec3(entry.x, entry.y, 0);
-      platforms.push_back(new NormalPlatform(s));
+      AddPlatform(NewNormalPlatform(p));
       printf("plat0 at (%g,%g)\n", entry.x, entry.y);
     }
     else if (entry.tag == "damagable0") {
-      ChunkSprite* s = new ChunkSprite(model_platforms[1]);
-      s->pos = glm::vec3(entry.x, entry.y, 0);
-      platforms.push_back(new DamagablePlatform(s));
+      AddPlatform(NewDamagablePlatform(p));
       printf("damagable0 at (%g,%g)\n", entry.x, entry.y);
     }
     else if (entry.tag == "coin") {
-      ChunkSprite* s = new ChunkSprite(model_coin);
-      s->pos = glm::vec3(entry.x, entry.y, 0);
-      coins.push_back(s);
+      AddCoin(NewCoin(p));
       printf("coin at (%g,%g)\n", entry.x, entry.y);
       num_coins++;
       num_coins_total++;
     }
     else if (entry.tag == "exit") {
-      ChunkSprite* s = new ChunkSprite(model_exit);
-      s->pos = glm::vec3(entry.x, entry.y, 0);
-      platforms.push_back(new ExitPlatform(s));
+      exit_platform = NewExitPlatform(p);
+      AddPlatform(exit_platform);
       printf("exit at (%g,%g)\n", entry.x, entry.y);
     }
   }
@@ -996,25 +1137,21 @@ void ClimbScene::ComputeCamBB() {
 }
 
 void ClimbScene::SetBackground(int bgid) {
-  for (ChunkSprite* s : backgrounds0) { delete s; }
-  for (ChunkSprite* s : backgrounds1) { delete s; }
-  backgrounds0.clear();
-  backgrounds1.clear();
-  
   // Background sprite
   // [1] [1] [1]
   // [0] [0] [0]
-  for (int i=0; i<5; i++) {
-    ChunkSprite* s = new ChunkSprite(model_backgrounds1[bgid]);
-    s->scale = glm::vec3(1,1,1) * BACKGROUND_SCALE;
-    backgrounds0.push_back(s);
+  // 第一次建好以后只换模型
+  if (backgrounds0 == nullptr) {
+    backgrounds0 = new ChunkBatchSprite(model_backgrounds1[bgid]);
+    backgrounds1 = new ChunkBatchSprite(model_backgrounds2[bgid]);
   }
-  
-  for (int i=0; i<20; i++) {
-    ChunkSprite* s = new ChunkSprite(model_backgrounds2[bgid]);
+  backgrounds0->chunk = model_backgrounds1[bgid];
+  backgrounds1->chunk = model_backgrounds2[bgid];
+  for (ChunkBatchSprite* s : { backgrounds0, backgrounds1 }) {
+    s->Init();
     s->scale = glm::vec3(1,1,1) * BACKGROUND_SCALE;
-    backgrounds1.push_back(s);
   }
+  render_list_dirty = true;
 }
 
 void ClimbScene::RotateCoins(float secs) {
@@ -1024,53 +1161,55 @@ void ClimbScene::RotateCoins(float secs) {
   }
 }
 
+void ClimbScene::UpdateParticles(float secs) {
+  const unsigned long long t0 = GetElapsedMicros();
+  GetGlobalParticles()->Update(secs);
+  phase_times.particles += GetElapsedMicros() - t0;
+}
+
 void ClimbScene::CameraFollow(float secs) {
   glm::vec3 p1 = GetPlayerEffectivePos(), p0 = camera->pos;
   const float z = camera->pos.z;
-  camera->pos = p1 * CAM_FOLLOW_DAMP + p0 * (1.0f - CAM_FOLLOW_DAMP);
+  const float damp = 1.0f - powf(1.0f - CAM_FOLLOW_DAMP, secs * SIM_REF_FPS);
+  camera->pos = p1 * damp + p0 * (1.0f - damp);
   // 超出边界就修理一下
   if (cam_aabb.ContainsPoint(camera->pos) == false) { 
     p1 = cam_aabb.GetClosestPoint(p1); p0 = camera->pos;
-    camera->pos = p1 * CAM_FOLLOW_DAMP + p0 * (1.0f - CAM_FOLLOW_DAMP);
+    camera->pos = p1 * damp + p0 * (1.0f - damp);
   }
   // 不管Z
   camera->pos.z = z;
 }
 
+void ClimbScene::GetBackgroundTicks(int* x_tick, int* y_tick) {
+  *x_tick = int(camera->pos.x / (100 * BACKGROUND_SCALE) + 0.5);
+  *y_tick = int(camera->pos.y / (100 * BACKGROUND_SCALE) + 0.5);
+}
+
 void ClimbScene::LayoutBackground() {
-  int x_tick = int(camera->pos.x / (100 * BACKGROUND_SCALE) + 0.5);
-  int y_tick = int(camera->pos.y / (100 * BACKGROUND_SCALE) + 0.5);
+  if (backgrounds0 == nullptr) return;  // 还没 SetBackground
+  int x_tick, y_tick;
+  GetBackgroundTicks(&x_tick, &y_tick);
+  bg_tick_x = x_tick;
+  bg_tick_y = y_tick;
   
 //  printf("layout CPOS=%g,%g xytick=%d,%d\n", camera->pos.x, camera->pos.y, x_tick, y_tick);
       
-  // 两种背景，bg0是地平线上的，bg1是天空的
-  int idx_bg0 = 0, idx_bg1 = 0;
+  // 两种背景，bg0是地平线上的，bg1是天空的；每种一批，一次画完
+  backgrounds0->ClearInstances();
+  backgrounds1->ClearInstances();
   
   const int dx = 2, dy = 1;
   
   for (int y = y_tick - dy; y <= y_tick + dy; y++) {
     for (int x = x_tick - dx; x <= x_tick + dx; x++) {
-      if (y == 0) {
-        if (idx_bg0 < int(backgrounds0.size())) {
-          ChunkSprite* b = backgrounds0[idx_bg0];
-          b->pos.x = x * 100.0f * BACKGROUND_SCALE;
-          b->pos.y = y * 100.0f * BACKGROUND_SCALE;
-          b->pos.z = 0;
-          sprite_render_list.push_back(b);
-          idx_bg0 ++;
-        }
-      } else if (y > 0) {
-        if (idx_bg1 < int(backgrounds1.size())) {
-          ChunkSprite* b = backgrounds1[idx_bg1];
-          b->pos.x = x * 100.0f * BACKGROUND_SCALE;
-          b->pos.y = y * 100.0f * BACKGROUND_SCALE;
-          b->pos.z = 0;
-          sprite_render_list.push_back(b);
-          idx_bg1 ++;
-        }
-      }
+      const glm::vec3 p(x * 100.0f * BACKGROUND_SCALE, y * 100.0f * BACKGROUND_SCALE, 0);
+      if (y == 0) backgrounds0->AddInstance(p);
+      else if (y > 0) backgrounds1->AddInstance(p);
     }
   }
+  if (backgrounds0->NumInstances() > 0) sprite_render_list.push_back(backgrounds0);
+  if (backgrounds1->NumInstances() > 0) sprite_render_list.push_back(backgrounds1);
 }
 
 void ClimbScene::SetGameState(ClimbGameState gs) {
@@ -1108,16 +1247,17 @@ void ClimbScene::ExitPlatform::Update(float secs) {
   switch (state) {
     case Hidden: { break; }
     case FlyingIn: { 
-      float completion = 1.0f - (fly_in_end_millis - GetElapsedMillis()) * 1.0f / FLY_IN_DURATION;
+      float completion = 1.0f - (fly_in_end_millis - GetSimulationMillis()) * 1.0f / FLY_IN_DURATION;
       if (completion > 1.0) {
         completion = 1.0;
       }
-      if (fly_in_end_millis < GetElapsedMillis()) { 
+      if (fly_in_end_millis < GetSimulationMillis()) { 
         state = Visible;
         completion = 1.0;
       }
       sprite->pos.z = 1000.0f * ((1.0f - completion) * (1.0f - completion));
       ClimbScene::instance->LayoutRocketsOnExit(sprite->pos);
+      ClimbScene::instance->static_shadow_version++;
       break;
     }
     case Visible: { break; }
@@ -1127,7 +1267,10 @@ void ClimbScene::ExitPlatform::Update(float secs) {
 void ClimbScene::LayoutRocketsOnExit(const glm::vec3& x) {
   printf("LayoutRocketsOnExit(%g,%g,%g)\n", x.x, x.y, x.z);
   const float Z_NUDGE = 5;
-  coins = initial_coins;
+  if (coins.size() != initial_coins.size()) {
+    coins = initial_coins;
+    render_list_dirty = true;
+  }
   
   // 把 coins 放在 player 周围
   glm::vec3 p0 = x + glm::vec3(0, 12, 0), p1 = p0;
@@ -1145,16 +1288,14 @@ void ClimbScene::LayoutRocketsOnExit(const glm::vec3& x) {
 
 void ClimbScene::ExitPlatform::FlyIn() {
   state = FlyingIn;
-  fly_in_end_millis = GetElapsedMillis() + FLY_IN_DURATION;
+  fly_in_end_millis = GetSimulationMillis() + FLY_IN_DURATION;
+  ClimbScene::instance->render_list_dirty = true;  // 开始显示了
 }
 
 void ClimbScene::RevealExit() {
   is_all_rockets_collected = true;
-  for (Platform* p : platforms) {
-    ExitPlatform* ep = dynamic_cast<ExitPlatform*>(p);
-    if (ep) {
-      ep->FlyIn();
-    }
+  if (exit_platform) {
+    exit_platform->FlyIn();
   }
 }
 
@@ -1181,6 +1322,7 @@ void ClimbScene::DamagablePlatform::DoDamage(const glm::vec3& world_x) {
   if (damaged == false) {
     damaged = true;
   }
+  ClimbScene::instance->static_shadow_version++;
   glm::vec3 lx = cs->GetVoxelCoord(world_x);
   const int R = 3;
   cs->chunk->SetVoxelSphere(lx, R, 0);
@@ -7,10 +7,33 @@
 
 #include <vector>
 #include <bitset>
+#include <assert.h>
 
 extern Camera g_cam;
 extern void UpdateSimpleTexturePerSceneCB(const float x, const float y, const float alpha);
 
+// 同一类对象的池子。Get 按顺序拿出已经建好的对象，用完了返回 nullptr，这时由调用者 new 一个再 Add；
+// ReleaseAll 把所有对象一次性还回去，对象本身不删，下次 Get 时由调用者重置。
+template<typename T>
+class ObjectPool {
+public:
+  T* Get() {
+    if (num_used < int(objects.size())) return objects[num_used++];
+    return nullptr;
+  }
+  T* Add(T* x) {
+    assert(num_used == int(objects.size()));
+    objects.push_back(x);
+    num_used++;
+    return x;
+  }
+  void ReleaseAll() { num_used = 0; }
+  int NumUsed() const { return num_used; }
+private:
+  std::vector<T*> objects;
+  int num_used = 0;
+};
+
 class GameScene {
 public:
   virtual void                  PrepareSpriteListForRender() = 0;
@@ -25,9 +48,15 @@ public:
   virtual void                  PostRender() = 0;
   virtual void                  RenderHUD() = 0;
   virtual void                  Update(float) = 0;
+  virtual void                  BeginStep() { }; // 每个固定步长之前调用
   virtual void                  OnKeyPressed(char key) { };
   virtual void                  OnKeyReleased(char key) { };
   
+  // 阴影缓存用：渲染列表的前 GetNumStaticSprites() 项是不动的投影物（平台、背景），
+  // 它们有任何变化时 GetStaticShadowVersion() 都会变
+  virtual int                   GetNumStaticSprites() { return 0; }
+  virtual unsigned              GetStaticShadowVersion() { return 0; }
+
   virtual void                  OnMouseMove(int mx, int my) { };
   virtual void                  OnMouseDown() { };
   virtual void                  OnMouseUp() { };
@@ -62,7 +91,9 @@ public:
 
 class ClimbScene : public GameScene {
 public:
+#ifdef WIN32
   void RenderLights() override;
+#endif
   // Static level info
   class LevelData {
   public:
@@ -97,10 +128,7 @@ public:
 
   class GameObject {
   public:
-    bool marked_for_removal = false;
-    void Remove() {
-      marked_for_removal = true;
-    }
+    int scene_idx = -1;  // 在 ClimbScene::platforms 里的下标，交换删除用
   };
 
   class Platform : public GameObject {
@@ -110,6 +138,7 @@ public:
     virtual Sprite* GetSpriteForCollision() = 0;
     virtual glm::vec3 GetOriginalPos() = 0;
     virtual void    Update(float) { }
+    virtual void    Reset(const glm::vec3& p);  // 从池子里拿出来重用时调用
     ~Platform() { delete sprite; }
   };
   
@@ -126,16 +155,18 @@ public:
   class DamagablePlatform : public Platform {
   public:
     bool damaged;
+    ChunkGrid* model;  // 复制的来源
     DamagablePlatform(Sprite* _s) {
       sprite = _s;
       
       // 复制体素信息
       ChunkSprite* cs = (ChunkSprite*)(sprite);
-      ChunkGrid* g = (ChunkGrid*)(cs->chunk);
-      cs->chunk = new ChunkGrid(*g);
+      model = (ChunkGrid*)(cs->chunk);
+      cs->chunk = new ChunkGrid(*model);
       
       damaged = false;
     }
+    void Reset(const glm::vec3& p);
     Sprite* GetSpriteForDisplay() { return sprite; }
     Sprite* GetSpriteForCollision() { return sprite; }
     glm::vec3 GetOriginalPos() { return sprite->pos; }
@@ -168,6 +199,7 @@ public:
     }
     glm::vec3 GetOriginalPos() { return sprite->pos; }
     void FlyIn();
+    void Reset(const glm::vec3& p);
   };
 
   //
@@ -191,18 +223,47 @@ public:
   ChunkSprite* anchor;
   glm::vec3 anchor_rope_endpoint;
   
-  std::vector<Platform*> platforms;
+  // 平台和硬币只能通过下面几个函数增删，删除是和最后一个交换再 pop_back。
+  // 增删时设 render_list_dirty，sprite_render_list 的前 num_retained_sprites 项只在那时重建。
+  // 这几个列表的内存都在 level_arena 里，换关时整个 Reset。
+  LevelArena level_arena;
+  typedef std::vector<Platform*, ArenaAllocator<Platform*> > PlatformList;
+  typedef std::vector<Sprite*, ArenaAllocator<Sprite*> > SpriteList;
+  PlatformList platforms;
+  ExitPlatform* exit_platform;  // 每关最多一个
+  void AddPlatform(Platform* p);
+  void RemovePlatform(Platform* p);
+  void AddCoin(Sprite* c);
+  void RemoveCoinAt(int idx);
+  void ClearObjects();
+  bool render_list_dirty;
+  int num_retained_sprites;
+  int num_static_sprites;          // 平台和背景，在 sprite_render_list 最前面
+  unsigned static_shadow_version;  // 平台、背景动了就加一
+  int GetNumStaticSprites() { return num_static_sprites; }
+  unsigned GetStaticShadowVersion() { return static_shadow_version; }
+
+  // 平台和硬币都从池子里拿，换关时 ReleaseAll，下一关接着用，不 new 也不 delete
+  ObjectPool<NormalPlatform>    normal_platform_pool;
+  ObjectPool<DamagablePlatform> damagable_platform_pool;
+  ObjectPool<ExitPlatform>      exit_platform_pool;
+  ObjectPool<ChunkSprite>       coin_pool;
+  NormalPlatform*    NewNormalPlatform(const glm::vec3& p);
+  DamagablePlatform* NewDamagablePlatform(const glm::vec3& p);
+  ExitPlatform*      NewExitPlatform(const glm::vec3& p);
+  ChunkSprite*       NewCoin(const glm::vec3& p);
   AABB cam_aabb;
   std::vector<Sprite*> rope_segments;
-  std::vector<ChunkSprite*> backgrounds0, backgrounds1;
+  ChunkBatchSprite *backgrounds0, *backgrounds1;  // 地平线上的和天空的，各一批
   
-  std::vector<Sprite*> coins, initial_coins;
+  SpriteList coins, initial_coins;
   int num_coins, num_coins_total;
   int curr_level;
   int curr_bgid;
   float curr_level_time;
   
   static void InitStatic();
+  static void PrewarmGlyphs(); // HUD 上固定的字
   
   // 资源
 #ifdef WIN32
@@ -272,11 +333,12 @@ public:
   ClimbScene();
   void Init();
   void PreRender();
-  void PostRender() { }
+  void PostRender();
   std::vector<Sprite*> sprite_render_list;
   void PrepareSpriteListForRender();
   std::vector<Sprite*>* GetSpriteListForRender();
   void Update(float secs);
+  void BeginStep();
   void RenderHUD();
   void RenderHUD_D3D11();
   void RenderHUD_D3D12();
@@ -288,11 +350,25 @@ public:
   DirectionalLight* lights[16];
   float light_phase = 0.0;
   void PrepareLights();
+
+  // 渲染插值：上一步的位置，和渲染前暂存的模拟位置
+  glm::vec3 player_pos_prev, camera_pos_prev;
+  glm::vec3 player_pos_sim, camera_pos_sim;
   
+  // 各阶段累计耗时（微秒），无头模拟测性能时用
+  struct PhaseTimes {
+    unsigned long long probe, collision, particles, render_list;
+    PhaseTimes() : probe(0), collision(0), particles(0), render_list(0) {}
+  };
+  PhaseTimes phase_times;
+
   // 每帧更新时做的事情
   void RotateCoins(float secs);
+  void UpdateParticles(float secs);
   void CameraFollow(float secs);
   void LayoutBackground();
+  void GetBackgroundTicks(int* x_tick, int* y_tick);
+  int bg_tick_x, bg_tick_y;  // 上次摆背景时镜头所在的格子
   void HideRope();
   
   glm::vec3 GetPlayerInitPos();
@@ -318,6 +394,7 @@ public:
   int curr_edit_option;  // 0, 1, 2, 3: 平台； 4: 指针
   Sprite* CurrentCursorSprite();
   Sprite* highlight_sprite;
+  bool UpdateEditModeHover();  // 拖动、拾取；需要画高亮框时返回 true
   bool CanHideMenu();
 
   int drag_mouse_x0, drag_mouse_y0;
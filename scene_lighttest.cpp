@@ -241,8 +241,8 @@ void ClimbScene::PrepareLights() {
 
   {
     if (is_all_rockets_collected) {
-      for (Platform* p : platforms) {
-        ExitPlatform* ep = dynamic_cast<ExitPlatform*>(p);
+      {
+        ExitPlatform* ep = exit_platform;
         if (ep) { // There should be only 1 exit platform
           glm::vec3 world_pos = ep->sprite->pos;
           float a = light_phase;
@@ -297,8 +297,8 @@ void ClimbScene::PrepareLights() {
 
   if (is_all_rockets_collected) {
     g_vol_light_cb.spotlightCount = 0;
-    for (Platform* p : platforms) {
-      ExitPlatform* ep = dynamic_cast<ExitPlatform*>(p);
+    {
+      ExitPlatform* ep = exit_platform;
       if (ep) { // There should be only 1 exit platform
         glm::vec3 pos = ep->sprite->pos;
         g_vol_light_cb.spotlightColors[0].m128_f32[0] = 1;
@@ -323,8 +323,6 @@ void ClimbScene::PrepareLights() {
         g_vol_light_cb.aspect = WIN_W * 1.0f / WIN_H;
         g_vol_light_cb.fovy = 60 * 3.14159f / 180.0f;
         g_vol_light_cb.forceAlwaysOn = 0;
-
-        break;
       }
     }
   }
@@ -1,86 +1,90 @@
 #include "shader.hpp"
 #include <GL/freeglut.h>
 
-unsigned CreateProgram(const char *vertex_shader_path,
-  const char *fragment_shader_path) {
-  std::string verShaderCode("");
-  std::ifstream verShaderStream(vertex_shader_path);
-  if( verShaderStream.is_open() ){
+// Reads and compiles one shader; returns 0 on failure
+static GLuint CompileShaderFile(GLenum type, const char *path) {
+  std::string code("");
+  std::ifstream stream(path);
+  if( stream.is_open() ){
     std::string line("");
-    while( getline(verShaderStream, line) )
-      verShaderCode += line + "\n";
-    verShaderStream.close();
+    while( getline(stream, line) )
+      code += line + "\n";
+    stream.close();
   } else{
-    std::cerr << "Error: Cann't open \"" << vertex_shader_path << "\" file." << std::endl;
+    std::cerr << "Error: Cann't open \"" << path << "\" file." << std::endl;
     return 0;
   }
 
-  GLuint verShader = glCreateShader(GL_VERTEX_SHADER);
-  const char *verShaderSource = verShaderCode.c_str();
-  glShaderSource(verShader, 1, &verShaderSource, NULL);
-  glCompileShader(verShader);
+  GLuint shader = glCreateShader(type);
+  const char *source = code.c_str();
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
 
   GLint result;
   int infoLogLength;
-  glGetShaderiv(verShader, GL_COMPILE_STATUS, &result);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
   if( result == GL_FALSE ){
-    glGetShaderiv(verShader, GL_INFO_LOG_LENGTH, &infoLogLength);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
     GLchar *errMessage = new GLchar[infoLogLength + 1];
-    glGetShaderInfoLog(verShader, infoLogLength, NULL, errMessage);
+    glGetShaderInfoLog(shader, infoLogLength, NULL, errMessage);
     errMessage[infoLogLength] = '\0';
-    std::cerr << "Error in \"" << vertex_shader_path << "\":" << std::endl;
+    std::cerr << "Error in \"" << path << "\":" << std::endl;
     std::cerr << errMessage << std::endl;
     delete [] errMessage;
+    glDeleteShader(shader);
     return 0;
   }
+  return shader;
+}
 
-  std::string fragShaderCode("");
-  std::ifstream fragShaderStream(fragment_shader_path);
-  if( fragShaderStream.is_open() ){
-    std::string line("");
-    while( getline(fragShaderStream, line) )
-      fragShaderCode += line + "\n";
-    fragShaderStream.close();
-  } else{
-    std::cerr << "Error: Cann't open \"" << fragment_shader_path << "\" file." << std::endl;
-    return 0;
-  }
-
-  GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-  const char *fragShaderSource = fragShaderCode.c_str();
-  glShaderSource(fragShader, 1, &fragShaderSource, NULL);
-  glCompileShader(fragShader);
-
-  glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
+static bool CheckLinkStatus(GLuint program, const char *path) {
+  GLint result;
+  int infoLogLength;
+  glGetProgramiv(program, GL_LINK_STATUS, &result);
   if( result == GL_FALSE ){
-    glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &infoLogLength);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
     GLchar *errMessage = new GLchar[infoLogLength + 1];
-    glGetShaderInfoLog(fragShader, infoLogLength, NULL, errMessage);
+    glGetProgramInfoLog(program, infoLogLength, NULL, errMessage);
     errMessage[infoLogLength] = '\0';
-    std::cerr << "Error in \"" << fragment_shader_path << "\":" << std::endl;
+    std::cerr << "Error in \"" << path << "\":" << std::endl;
     std::cerr << errMessage << std::endl;
     delete [] errMessage;
-    return 0;
+    return false;
   }
+  return true;
+}
+
+unsigned CreateProgram(const char *vertex_shader_path,
+  const char *fragment_shader_path) {
+  GLuint verShader = CompileShaderFile(GL_VERTEX_SHADER, vertex_shader_path);
+  if (verShader == 0) return 0;
+  GLuint fragShader = CompileShaderFile(GL_FRAGMENT_SHADER, fragment_shader_path);
+  if (fragShader == 0) return 0;
 
   GLuint program = glCreateProgram();
   glAttachShader(program, verShader);
   glAttachShader(program, fragShader);
   glLinkProgram(program);
 
-  glGetProgramiv(program, GL_LINK_STATUS, &result);
-  if( result == GL_FALSE ){
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
-    GLchar *errMessage = new GLchar[infoLogLength + 1];
-    glGetProgramInfoLog(fragShader, infoLogLength, NULL, errMessage);
-    errMessage[infoLogLength] = '\0';
-    std::cerr << "Error in \"" << fragment_shader_path << "\":" << std::endl;
-    std::cerr << errMessage << std::endl;
-    delete [] errMessage;
-    return 0;
-  }
+  if (!CheckLinkStatus(program, fragment_shader_path)) return 0;
 
   glDeleteShader(verShader);
   glDeleteShader(fragShader);
   return program;
-}
\ No newline at end of file
+}
+
+unsigned CreateTransformFeedbackProgram(const char *vertex_shader_path,
+  const char **varyings, int num_varyings) {
+  GLuint verShader = CompileShaderFile(GL_VERTEX_SHADER, vertex_shader_path);
+  if (verShader == 0) return 0;
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, verShader);
+  glTransformFeedbackVaryings(program, num_varyings, varyings, GL_INTERLEAVED_ATTRIBS);
+  glLinkProgram(program);
+
+  if (!CheckLinkStatus(program, vertex_shader_path)) return 0;
+
+  glDeleteShader(verShader);
+  return program;
+}
@@ -1,7 +1,11 @@
 #ifndef _SHADER_HPP
 #define _SHADER_HPP
 
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -11,5 +15,8 @@
 // Copied from 
 unsigned CreateProgram(const char *vertex_shader_path,
   const char *fragment_shader_path);
+// Vertex shader only; outputs listed in varyings are interleaved into the transform feedback buffer
+unsigned CreateTransformFeedbackProgram(const char *vertex_shader_path,
+  const char **varyings, int num_varyings);
   
 #endif
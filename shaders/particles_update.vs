@@ -0,0 +1,30 @@
+#version 330 core
+
+// Advances particle state with transform feedback (see gpuparticles.cpp).
+// Same integration as particlekernel.cpp; dead particles are moved far below the scene.
+
+layout (location = 0) in vec3  pos;
+layout (location = 1) in vec3  vel;
+layout (location = 2) in float lifetime;
+layout (location = 3) in float inv_lifetime_full;
+
+uniform float secs;
+uniform float k;
+
+out vec3  out_pos;
+out vec3  out_vel;
+out float out_lifetime;
+out float out_inv_lifetime_full;
+
+void main() {
+  float f = lifetime * inv_lifetime_full;
+  float s = f * f * k;
+  out_lifetime = lifetime - secs;
+  if (out_lifetime > 0) {
+    out_pos = pos + vel * s;
+  } else {
+    out_pos = vec3(0, -100000, 0);
+  }
+  out_vel = vel;
+  out_inv_lifetime_full = inv_lifetime_full;
+}
@@ -1,11 +1,22 @@
 #version 330 core
 
+// Depth-only variant of vert_norm_data_ao.vs for the shadow pass and the
+// depth pre-pass: only the position (and the per-instance offset) is fetched.
+// gl_Position must match vert_norm_data_ao.vs bit for bit, so both are
+// computed the same way and declared invariant.
 layout (location = 0) in vec3 position;
+layout (location = 4) in float instance_x;
+layout (location = 5) in float instance_y;
+layout (location = 6) in float instance_z;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+uniform mat4 M;
+uniform mat4 V;
+uniform mat4 P;
+
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(position, 1.0f);
-}
\ No newline at end of file
+    vec4 world_pos = M * vec4(position, 1.0f) + vec4(instance_x, instance_y, instance_z, 0.0f);
+    gl_Position = P * V * world_pos;
+}
@@ -4,10 +4,17 @@ out vec4 color;
 
 uniform sampler2D text;
 uniform vec3 textColor;
+uniform bool sdf;
 
 void main()
 {    
-    vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, TexCoords).r);
+    // TexCoords are in atlas pixels
+    vec2 uv = TexCoords / vec2(textureSize(text, 0));
+    float a = texture(text, uv).r;
+    // Signed distance field: 0.5 is the edge, smooth over about one screen pixel
+    float w = fwidth(a) * 0.7;
+    if (sdf) a = smoothstep(0.5 - w, 0.5 + w, a);
+    vec4 sampled = vec4(1.0, 1.0, 1.0, a);
     color = vec4(textColor, 1.0) * sampled;
     //color = vec4(1, 1, 1, 1);
 } 
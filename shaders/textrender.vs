@@ -5,6 +5,7 @@ out vec2 TexCoords;
 uniform vec2 screensize;
 uniform mat4 transform;
 uniform mat4 projection;
+uniform vec2 offset;
 
 void main()
 {
@@ -12,7 +13,7 @@ void main()
 	const float half_yext = Z * tan(fovy);
 	float half_xext = half_yext / screensize.y * screensize.x;
 
-	vec2 xy = vertex.xy / screensize;
+	vec2 xy = (vertex.xy + offset) / screensize;
 	xy.y = 1.0 - xy.y;
 	xy = xy * 2.0f - vec2(1.0f, 1.0f);
 	xy = xy * vec2(half_xext, half_yext);
@@ -4,11 +4,16 @@ layout (location = 0) in vec3  position;
 layout (location = 1) in float normal_idx;
 layout (location = 2) in float color_idx;
 layout (location = 3) in float ao;
+// Per-instance world offset (particles); stays 0 for ordinary draws
+layout (location = 4) in float instance_x;
+layout (location = 5) in float instance_y;
+layout (location = 6) in float instance_z;
 
 out VS_OUT {
 	vec3 vert_color;
 	vec3 normal;
 	vec4 frag_pos_lightspace;
+	vec4 frag_pos_lightspace_static;
 } vs_out;
 
 
@@ -17,6 +22,9 @@ uniform mat4 V;
 uniform mat4 P;
 
 uniform mat4 lightPV;
+uniform mat4 lightPV_static; // the static shadow layer has its own projection
+
+invariant gl_Position; // must match simple_depth.vs for the depth pre-pass
 
 vec3 default_palette[256] = vec3[](
     vec3(0.000,0.000,0.000),vec3(1.000,1.000,1.000),vec3(1.000,1.000,0.800),vec3(1.000,1.000,0.600),vec3(1.000,1.000,0.400),vec3(1.000,1.000,0.200),vec3(1.000,1.000,0.000),vec3(1.000,0.800,1.000),
@@ -64,10 +72,12 @@ vec3 default_normals[6] = vec3[](
 void main()
 {
     float occ = 1.0f - ao * 0.2f;
-    gl_Position = P * V * M * vec4(position, 1.0f);
+    vec4 world_pos = M * vec4(position, 1.0f) + vec4(instance_x, instance_y, instance_z, 0.0f);
+    gl_Position = P * V * world_pos;
 	vs_out.vert_color = default_palette[int(color_idx)] * occ;
 	vs_out.normal     = default_normals[int(normal_idx)];
 	
-	vec3 frag = vec3(M * vec4(position, 1.0f)); 
+	vec3 frag = vec3(world_pos); 
 	vs_out.frag_pos_lightspace = lightPV * vec4(frag, 1.0);
+	vs_out.frag_pos_lightspace_static = lightPV_static * vec4(frag, 1.0);
 }
\ No newline at end of file
@@ -5,6 +5,17 @@ struct VSInput {
   float  ao   : COLOR2;
 };
 
+// Particles: same mesh drawn many times, one world offset per instance
+struct VSInputInstanced {
+  float3 position : POSITION;
+  float  nidx : COLOR;
+  float  attr1: COLOR1;
+  float  ao   : COLOR2;
+  float  instance_x : INSTANCE_POS0;
+  float  instance_y : INSTANCE_POS1;
+  float  instance_z : INSTANCE_POS2;
+};
+
 struct VSOutput {
   float4 position : SV_POSITION;
   float3 color : COLOR;
@@ -88,6 +99,19 @@ VSOutput VSMain(VSInput input) {
   return output;
 }
 
+// Offsets are stored in OpenGL coordinates, so flip z like Render_D3D11 does
+VSOutput VSMainInstanced(VSInputInstanced input) {
+  VSOutput output;
+  float occ = 1.0f - input.ao * 0.2f;
+  float4 world = mul(M, float4(input.position, 1.0f)) + float4(input.instance_x, input.instance_y, -input.instance_z, 0.0f);
+  output.normal = default_normals[int(input.nidx)];
+  output.position = mul(P, mul(V, world));
+  output.color = default_palette[(int)(input.attr1)] * occ;
+  output.frag_pos_lightspace = mul(lightPV, world);
+  output.frag_pos_worldspace = world;
+  return output;
+}
+
 PSOutput PSMainWithoutShadow(VSOutput input) {
   PSOutput output;
   output.color = float4(input.color, 1.0f);
@@ -0,0 +1,33 @@
+// Advances particle state in place (see gpuparticles.cpp).
+// Layout per particle: float3 pos, float3 vel, float lifetime, float inv_lifetime_full = 32 bytes.
+// Same integration as particlekernel.cpp; dead particles are moved far below the scene.
+
+RWByteAddressBuffer particles : register(u0);
+
+cbuffer ParticleUpdateCB : register(b0) {
+  float secs;
+  float k;
+  uint count;
+  float pad;
+};
+
+[numthreads(64, 1, 1)]
+void CSMain(uint3 id : SV_DispatchThreadID) {
+  if (id.x >= count) return;
+  uint base = id.x * 32;
+  float3 pos = asfloat(particles.Load3(base));
+  float3 vel = asfloat(particles.Load3(base + 12));
+  float lifetime = asfloat(particles.Load(base + 24));
+  float inv_lifetime_full = asfloat(particles.Load(base + 28));
+
+  float f = lifetime * inv_lifetime_full;
+  float s = f * f * k;
+  lifetime -= secs;
+  if (lifetime > 0) {
+    pos += vel * s;
+  } else {
+    pos = float3(0, -100000, 0);
+  }
+  particles.Store3(base, asuint(pos));
+  particles.Store(base + 24, asuint(lifetime));
+}
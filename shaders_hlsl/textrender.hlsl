@@ -17,6 +17,8 @@ cbuffer CBPerScene : register(b0) {
   float4x4 transform;
   float4x4 projection;
   float4 textcolor;
+  float4 offset;
+  float4 sdf_params;  // x: 1 = signed distance field glyphs
 };
 
 Texture2D charTex;
@@ -30,7 +32,7 @@ VSOutput VSMain(VSInput input) {
   const float half_yext = Z * tan(fovy);
   float half_xext = half_yext / screensize.y * screensize.x;
   
-  float2 xy = input.position.xy / screensize.xy;
+  float2 xy = (input.position.xy + offset.xy) / screensize.xy;
   xy.y = 1.0 - xy.y;
   xy = xy * 2.0f - float2(1.0f, 1.0f);
   xy = xy * float2(half_xext, half_yext);
@@ -39,7 +41,13 @@ VSOutput VSMain(VSInput input) {
 }
 
 PSOutput PSMain(VSOutput input) {
-  float c = charTex.Sample(charTexSampler, input.texcoord.xy).r;
+  // texcoord is in atlas pixels
+  float w, h;
+  charTex.GetDimensions(w, h);
+  float c = charTex.Sample(charTexSampler, input.texcoord.xy / float2(w, h)).r;
+  // Signed distance field: 0.5 is the edge, smooth over about one screen pixel
+  float fw = fwidth(c) * 0.7;
+  if (sdf_params.x > 0.5) c = smoothstep(0.5 - fw, 0.5 + fw, c);
   PSOutput output;
   output.color = float4(textcolor.xyz, c);
   return output;
@@ -128,5 +128,6 @@ void InitSounds() {
 }
 
 void MyPlaySound(CyclimbSound s) {
+  if (g_sound_source == nullptr) return; // 无头模式下没有初始化声音
   g_sound_source->Play(s);
 }
\ No newline at end of file
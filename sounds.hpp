@@ -6,10 +6,6 @@
 #include <unordered_map>
 #include <vector>
 
-#include <AL/alc.h>
-#include <AL/alext.h>
-#include <sndfile.h>
-
 enum class CyclimbSound {
   Tap,
   SmallHit,
@@ -17,6 +13,14 @@ enum class CyclimbSound {
   Whistle,
 };
 
+void InitSounds();
+void MyPlaySound(CyclimbSound s);
+
+#ifndef CYCLIMB_HEADLESS
+#include <AL/alc.h>
+#include <AL/alext.h>
+#include <sndfile.h>
+
 class SoundDevice {
 public:
   static SoundDevice* get() {
@@ -94,6 +98,4 @@ private:
   ALuint p_Buffer = 0;
   std::unordered_map<CyclimbSound, ALuint> sounds;
 };
-
-void InitSounds();
-void MyPlaySound(CyclimbSound s);
\ No newline at end of file
+#endif
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include "util.hpp"
+#include "camera.hpp"
 #define _USE_MATH_DEFINES
 #include <math.h>
 
@@ -101,6 +102,69 @@ AABB ChunkSprite::GetAABBInWorld() {
   return AABB(lb, ub);
 }
 
+//============CHUNK BATCH SPRITE===================
+extern Camera* GetCurrentSceneCamera();
+
+void ChunkBatchSprite::ClearInstances() {
+  instances.clear();
+  pos = glm::vec3(0, 0, 0);
+  instances_dirty = true;
+}
+
+void ChunkBatchSprite::AddInstance(const glm::vec3& p) {
+  instances.push_back(p);
+  pos += (p - pos) / float(instances.size());
+  instances_dirty = true;
+}
+
+void ChunkBatchSprite::Render() {
+  if (instances.empty()) return;
+#ifndef CYCLIMB_HEADLESS
+  if (instances_dirty) {
+    if (instance_vbo == 0) glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    instances_dirty = false;
+  }
+#endif
+  // 离相机最近的一份的中心
+  const glm::vec3 cam_pos = GetCurrentSceneCamera()->pos;
+  const glm::vec3 center = orientation * ((chunk->Size() * 0.5f - anchor) * scale);
+  float dist = 1e20f;
+  for (const glm::vec3& p : instances) dist = std::min(dist, glm::length(p + center - cam_pos));
+  ChunkGrid* grid = (ChunkGrid*)chunk;
+  const InstanceLayout layout = { sizeof(glm::vec3), { 0, sizeof(float), sizeof(float) * 2 } };
+  grid->RenderMergedInstanced(scale, orientation, anchor, instance_vbo, layout, int(instances.size()),
+    grid->PickLOD(glm::length(orientation[0] * scale.x), dist));
+}
+
+#ifdef WIN32
+void ChunkBatchSprite::Render_D3D11() {
+  for (const glm::vec3& p : instances) chunk->Render_D3D11(p, scale, orientation, anchor);
+}
+
+void ChunkBatchSprite::RecordRenderCommand_D3D12(
+  ChunkPass* chunk_pass,
+  const DirectX::XMMATRIX& V,
+  const DirectX::XMMATRIX& P) {
+  for (const glm::vec3& p : instances)
+    chunk->RecordRenderCommand_D3D12(chunk_pass, p, scale, orientation, anchor, V, P);
+}
+#endif
+
+AABB ChunkBatchSprite::GetAABBInWorld() {
+  const glm::vec3 pos0 = pos;
+  glm::vec3 ub(-1e20f, -1e20f, -1e20f), lb(1e20f, 1e20f, 1e20f);
+  for (const glm::vec3& p : instances) {
+    pos = p;
+    const AABB aabb = ChunkSprite::GetAABBInWorld();
+    lb = glm::min(lb, aabb.lb); ub = glm::max(ub, aabb.ub);
+  }
+  pos = pos0;
+  return AABB(lb, ub);
+}
+
 //============CHUNK ANIM SPRITE===================
 ChunkAnimSprite::ChunkAnimSprite(std::vector<ChunkIndex*>* _c, std::vector<float>* _ts) {
   orientation = glm::mat3(1);
@@ -2,7 +2,11 @@
 #define SPRITE_H
 
 #define GLM_FORCE_RADIANS
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <map>
@@ -41,6 +45,10 @@ public:
   virtual void Update(float);
   virtual bool IntersectPoint(const glm::vec3& p_world) = 0;
   virtual bool IntersectPoint(const glm::vec3& p_world, int tolerance) = 0;
+  // 排序用：同一个模型返回同一个值，好放在一起画
+  virtual const void* GetModelKey() { return this; }
+  // 世界包围盒，阴影范围用；没有的返回 false
+  virtual bool GetWorldBounds(AABB* aabb) { return false; }
   void RotateAroundLocalAxis(const glm::vec3& axis, const float deg);
   void RotateAroundGlobalAxis(const glm::vec3& axis, const float deg);
   glm::vec3 GetVoxelCoord(const glm::vec3& p_world);
@@ -67,7 +75,32 @@ public:
     const DirectX::XMMATRIX& V,
     const DirectX::XMMATRIX& P);
 #endif
-  AABB GetAABBInWorld();
+  virtual AABB GetAABBInWorld();
+  virtual const void* GetModelKey() { return chunk; }
+  virtual bool GetWorldBounds(AABB* aabb) { *aabb = GetAABBInWorld(); return true; }
+};
+
+// 同一个 ChunkGrid 摆很多份，只有位置不同（背景）。pos 是所有份的中心，只用来排序。
+// GL 下各份的位置放在实例缓冲里，整批一次 Draw，LOD 按最近的一份选；D3D 下还是一份一份画
+class ChunkBatchSprite : public ChunkSprite {
+public:
+  ChunkBatchSprite(ChunkGrid* _c) : ChunkSprite(_c), instance_vbo(0), instances_dirty(true) { }
+  void ClearInstances();
+  void AddInstance(const glm::vec3& p);
+  int  NumInstances() const { return int(instances.size()); }
+  virtual void Render();
+#ifdef WIN32
+  virtual void Render_D3D11();
+  virtual void RecordRenderCommand_D3D12(
+    ChunkPass* chunk_pass,
+    const DirectX::XMMATRIX& V,
+    const DirectX::XMMATRIX& P);
+#endif
+  virtual AABB GetAABBInWorld();
+private:
+  std::vector<glm::vec3> instances;
+  GLuint instance_vbo;
+  bool instances_dirty;
 };
 
 class ChunkAnimSprite : public Sprite {
@@ -1,6 +1,10 @@
 #ifndef TESTSHAPES_H
 #define TESTSHAPES_H
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader.hpp"
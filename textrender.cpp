@@ -9,7 +9,14 @@
 #include <wrl/client.h>
 using Microsoft::WRL::ComPtr;
 #endif
-GLuint vao, vbo;
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <math.h>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 extern int WIN_W, WIN_H;
 extern int g_font_size;
 #ifdef WIN32
@@ -26,18 +33,521 @@ ID3D11InputLayout *input_layout11;
 extern GLuint g_programs[];
 
 
-std::map<wchar_t, Character> g_characters;
-#ifdef WIN32
-std::map<wchar_t, Character_D3D11> g_characters_d3d11;
-#endif
+GlyphAtlas g_glyph_atlas;
+bool g_sdf_text = false;
 FT_Face g_face;
+static GLuint g_atlas_tex;
+
+// GL 的文字 program 的 uniform 位置，InitTextRender 里查一次
+static struct {
+  GLuint program;
+  GLint text_color, screensize, transform, projection, offset, sdf;
+} g_text_gl;
+static glm::mat4 g_text_projection;
+static int g_text_projection_w, g_text_projection_h; // 窗口大小变了才重算
+static glm::vec3 g_text_last_color;
+static glm::mat4 g_text_last_transform;
+static bool g_text_batch_fresh;  // 这一批还没设过颜色和变换
 
 #ifdef WIN32
-static ID3D11Buffer* vertex_buffer11;
 static ID3D11Buffer* textcb_perscene11;
+static ID3D11Texture2D* g_atlas_tex11;
+static ID3D11ShaderResourceView* g_atlas_srv11;
 extern ID3D11BlendState* g_blendstate11;
 #endif
 
+static void ClearTextLayouts();
+
+// 光栅化好、还没放进图集的字
+struct GlyphBitmap {
+  wchar_t ch;
+  glm::ivec2 size;
+  glm::vec2 bearing;
+  GLuint advance;
+  std::vector<unsigned char> pixels;  // size.x * size.y
+};
+static bool RasterizeGlyph(FT_Face face, int font_size, bool sdf, wchar_t ch, GlyphBitmap* out);
+
+// 后台光栅化线程，用自己的 FT_Face（FreeType 的 face 不能跨线程用）
+static std::thread* g_glyph_worker;
+static std::mutex g_glyph_mutex;
+static std::condition_variable g_glyph_cv;
+static std::deque<wchar_t> g_glyph_requests;
+static std::vector<GlyphBitmap> g_glyph_results;
+static std::atomic<int> g_glyph_num_results(0);
+static bool g_glyph_worker_quit;
+
+static void GlyphWorker(FT_Library ft, FT_Face face, int font_size, bool sdf) {
+  while (true) {
+    wchar_t ch;
+    {
+      std::unique_lock<std::mutex> lock(g_glyph_mutex);
+      g_glyph_cv.wait(lock, [] { return g_glyph_worker_quit || !g_glyph_requests.empty(); });
+      if (g_glyph_worker_quit) break;
+      ch = g_glyph_requests.front();
+      g_glyph_requests.pop_front();
+    }
+    GlyphBitmap result;
+    RasterizeGlyph(face, font_size, sdf, ch, &result);
+    {
+      std::lock_guard<std::mutex> lock(g_glyph_mutex);
+      g_glyph_results.push_back(std::move(result));
+      g_glyph_num_results++;
+    }
+  }
+  FT_Done_Face(face);
+  FT_Done_FreeType(ft);
+}
+
+static void StopGlyphWorker() {
+  if (g_glyph_worker == nullptr) return;
+  {
+    std::lock_guard<std::mutex> lock(g_glyph_mutex);
+    g_glyph_worker_quit = true;
+  }
+  g_glyph_cv.notify_one();
+  g_glyph_worker->join();
+  delete g_glyph_worker;
+  g_glyph_worker = nullptr;
+  g_glyph_requests.clear();
+  g_glyph_results.clear();
+  g_glyph_num_results = 0;
+}
+
+static bool StartGlyphWorker(const char* font_file, int font_size, bool sdf) {
+  FT_Library ft;
+  FT_Face face;
+  if (FT_Init_FreeType(&ft)) return false;
+  if (FT_New_Face(ft, font_file, 0, &face)) {
+    FT_Done_FreeType(ft);
+    return false;
+  }
+  FT_Set_Pixel_Sizes(face, 0, font_size);
+  static bool atexit_registered = false;
+  if (!atexit_registered) {
+    atexit(StopGlyphWorker);  // 不然退出时 std::thread 还在等 condition_variable
+    atexit_registered = true;
+  }
+  g_glyph_worker_quit = false;
+  g_glyph_worker = new std::thread(GlyphWorker, ft, face, font_size, sdf);
+  return true;
+}
+
+void GlyphAtlas::Init(FT_Face _face, const char* font_file) {
+  StopGlyphWorker();
+  face = _face;
+  font_size = face ? face->size->metrics.y_ppem : 0;
+  sdf = g_sdf_text;
+  quad_scale = sdf ? font_size * 1.0f / SDF_SIZE : 1.0f;
+  glyphs.clear();
+  ClearTextLayouts();
+  generation = 0;
+  width = WIDTH;
+  height = INIT_HEIGHT;
+  pixels.assign(width * height, 0);
+  shelf_x = shelf_y = shelf_h = 0;
+  resized = true;
+  dirty_y0 = height;
+  dirty_y1 = 0;
+
+  // 占位用的空心方框，大小按字号
+  const int pw = std::max(2, int(font_size * 0.5f / quad_scale)), ph = std::max(2, int(font_size * 0.7f / quad_scale));
+  const int border = std::max(1, int(1.0f / quad_scale + 0.5f));
+  std::vector<unsigned char> box(pw * ph, 0);
+  for (int y = 0; y < ph; y++) {
+    for (int x = 0; x < pw; x++) {
+      if (x < border || y < border || x >= pw - border || y >= ph - border) box[y * pw + x] = 255;
+    }
+  }
+  placeholder.size = glm::ivec2(pw, ph);
+  placeholder.bearing = glm::vec2(1, ph);
+  placeholder.advance = 0;
+  placeholder.state = StateReady;
+  placeholder.missing = false;
+  if (face) Insert(L'?', &placeholder, box.data(), pw);
+
+  async = false;
+  if (face && font_file) {
+    async = StartGlyphWorker(font_file, font_size, sdf);
+    if (!async) printf("Could not start glyph worker for %s, rasterizing on the main thread\n", font_file);
+  }
+}
+
+bool GlyphAtlas::Grow() {
+  if (height >= MAX_HEIGHT) return false;
+  height *= 2;
+  pixels.resize(width * height, 0); // 宽度不变，原来的行不用动
+  resized = true;
+  printf("Glyph atlas grown to %dx%d\n", width, height);
+  return true;
+}
+
+bool GlyphAtlas::Pack(int w, int h, glm::ivec2* pos) {
+  w += PADDING;
+  h += PADDING;
+  if (w > width) return false;
+  if (shelf_x + w > width) { // 换行
+    shelf_y += shelf_h;
+    shelf_x = 0;
+    shelf_h = 0;
+  }
+  while (shelf_y + h > height) {
+    if (!Grow()) return false;
+  }
+  *pos = glm::ivec2(shelf_x, shelf_y);
+  shelf_x += w;
+  if (h > shelf_h) shelf_h = h;
+  return true;
+}
+
+// 把一个字的位图拷进图集，g->size 是位图大小
+void GlyphAtlas::Insert(wchar_t ch, Glyph* g, const unsigned char* bitmap, int pitch) {
+  if (g->size.x == 0 || g->size.y == 0) return; // 空格
+  if (!Pack(g->size.x, g->size.y, &g->pos)) {
+    printf("Glyph atlas is full, dropping character %d\n", int(ch));
+    g->size = glm::ivec2(0, 0);
+    return;
+  }
+  for (int y = 0; y < g->size.y; y++) {
+    memcpy(&pixels[(g->pos.y + y) * width + g->pos.x], bitmap + y * pitch, g->size.x);
+  }
+  if (g->pos.y < dirty_y0) dirty_y0 = g->pos.y;
+  if (g->pos.y + g->size.y > dirty_y1) dirty_y1 = g->pos.y + g->size.y;
+}
+
+// Felzenszwalb & Huttenlocher 的一维平方距离变换
+static void DistanceTransform1D(const float* f, float* d, int n, int* v, float* z) {
+  const float INF = 1e20f;
+  int k = 0;
+  v[0] = 0;
+  z[0] = -INF;
+  z[1] = INF;
+  for (int q = 1; q < n; q++) {
+    float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = INF;
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k + 1] < q) k++;
+    d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+}
+
+// grid 里 0 是目标、INF 是其它，变换后是到最近目标的平方距离
+static void DistanceTransform2D(std::vector<float>* grid, int w, int h) {
+  const int n = std::max(w, h);
+  std::vector<float> f(n), d(n), z(n + 1);
+  std::vector<int> v(n);
+  for (int x = 0; x < w; x++) {
+    for (int y = 0; y < h; y++) f[y] = (*grid)[y * w + x];
+    DistanceTransform1D(f.data(), d.data(), h, v.data(), z.data());
+    for (int y = 0; y < h; y++) (*grid)[y * w + x] = d[y];
+  }
+  for (int y = 0; y < h; y++) {
+    DistanceTransform1D(&(*grid)[y * w], d.data(), w, v.data(), z.data());
+    memcpy(&(*grid)[y * w], d.data(), sizeof(float) * w);
+  }
+}
+
+// FreeType 2.10 还没有 FT_RENDER_MODE_SDF，所以自己算：
+// 按 SDF_SIZE * SDF_HIRES 的字号光栅化，内外各做一次距离变换，再每 SDF_HIRES 个像素取一个
+static bool RasterizeGlyphSDF(FT_Face face, int font_size, wchar_t ch, GlyphBitmap* out) {
+  const int SDF_SIZE = GlyphAtlas::SDF_SIZE, SDF_SPREAD = GlyphAtlas::SDF_SPREAD, SDF_HIRES = GlyphAtlas::SDF_HIRES;
+  FT_Set_Pixel_Sizes(face, 0, SDF_SIZE * SDF_HIRES);
+  const bool ok = (FT_Load_Char(face, ch, FT_LOAD_RENDER) == 0);
+  FT_Set_Pixel_Sizes(face, 0, font_size);
+  const FT_Bitmap& bm = face->glyph->bitmap;
+  const int left = face->glyph->bitmap_left, top = face->glyph->bitmap_top;
+  if (!ok || bm.buffer == nullptr || bm.width == 0 || bm.rows == 0) return ok;
+
+  const int pad = SDF_SPREAD * SDF_HIRES;
+  const int W = bm.width + pad * 2, H = bm.rows + pad * 2;
+  const float INF = 1e20f;
+  std::vector<float> outside(W * H, INF), inside(W * H, 0);
+  for (int y = 0; y < int(bm.rows); y++) {
+    for (int x = 0; x < int(bm.width); x++) {
+      if (bm.buffer[y * bm.pitch + x] > 127) {
+        outside[(y + pad) * W + x + pad] = 0;
+        inside[(y + pad) * W + x + pad] = INF;
+      }
+    }
+  }
+  DistanceTransform2D(&outside, W, H);
+  DistanceTransform2D(&inside, W, H);
+
+  const int w = (W + SDF_HIRES - 1) / SDF_HIRES, h = (H + SDF_HIRES - 1) / SDF_HIRES;
+  out->pixels.resize(w * h);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const int sx = std::min(x * SDF_HIRES + SDF_HIRES / 2, W - 1);
+      const int sy = std::min(y * SDF_HIRES + SDF_HIRES / 2, H - 1);
+      const float dist = sqrtf(outside[sy * W + sx]) - sqrtf(inside[sy * W + sx]); // 外面为正
+      const float val = 0.5f - dist / (2.0f * pad);
+      out->pixels[y * w + x] = (unsigned char)(glm::clamp(val, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+  }
+  out->size = glm::ivec2(w, h);
+  out->bearing = glm::vec2(left * 1.0f / SDF_HIRES - SDF_SPREAD, top * 1.0f / SDF_HIRES + SDF_SPREAD);
+  return true;
+}
+
+// 主线程和后台线程都用，只碰传进来的 face
+static bool RasterizeGlyph(FT_Face face, int font_size, bool sdf, wchar_t ch, GlyphBitmap* out) {
+  out->ch = ch;
+  out->size = glm::ivec2(0, 0);
+  out->bearing = glm::vec2(0, 0);
+  out->advance = 0;
+  out->pixels.clear();
+  if (FT_Load_Char(face, ch, sdf ? FT_LOAD_DEFAULT : FT_LOAD_RENDER)) { // 字宽按实际字号
+    printf("Oh! Could not load character for rendering.\n");
+    return false;
+  }
+  out->advance = (GLuint)(face->glyph->advance.x);
+  if (sdf) return RasterizeGlyphSDF(face, font_size, ch, out);
+
+  const FT_Bitmap& bm = face->glyph->bitmap;
+  if (bm.buffer == nullptr || bm.width == 0 || bm.rows == 0) return true; // 空格
+  out->size = glm::ivec2(bm.width, bm.rows);
+  out->bearing = glm::vec2(face->glyph->bitmap_left, face->glyph->bitmap_top);
+  out->pixels.resize(bm.width * bm.rows);
+  for (int y = 0; y < int(bm.rows); y++) {
+    memcpy(&out->pixels[y * bm.width], bm.buffer + y * bm.pitch, bm.width);
+  }
+  return true;
+}
+
+void GlyphAtlas::Place(Glyph* g, const GlyphBitmap& bitmap) {
+  g->size = bitmap.size;
+  g->bearing = bitmap.bearing;
+  g->advance = bitmap.advance;
+  g->pos = glm::ivec2(0, 0);
+  g->state = StateReady;
+  Insert(bitmap.ch, g, bitmap.pixels.data(), bitmap.size.x);
+}
+
+const GlyphAtlas::Glyph* GlyphAtlas::GetMetrics(wchar_t ch) {
+  std::map<wchar_t, Glyph>::iterator itr = glyphs.find(ch);
+  if (itr != glyphs.end()) return &(itr->second);
+  Glyph& g = glyphs[ch];
+  g.size = g.pos = glm::ivec2(0, 0);
+  g.bearing = glm::vec2(0, 0);
+  g.advance = 0;
+  g.state = StateMetricsOnly;
+  g.missing = false;
+  if (face) {
+    g.missing = (ch != 0 && FT_Get_Char_Index(face, ch) == 0);
+    if (FT_Load_Char(face, ch, FT_LOAD_DEFAULT) == 0) {
+      g.advance = (GLuint)(face->glyph->advance.x);
+    }
+  }
+  return &g;
+}
+
+// 没有后台线程时当场光栅化，否则排队，先用占位框
+void GlyphAtlas::Request(wchar_t ch, Glyph* g) {
+  if (g->state != StateMetricsOnly || face == nullptr) return;
+  if (async) {
+    g->state = StateQueued;
+    {
+      std::lock_guard<std::mutex> lock(g_glyph_mutex);
+      g_glyph_requests.push_back(ch);
+    }
+    g_glyph_cv.notify_one();
+  } else {
+    GlyphBitmap bitmap;
+    RasterizeGlyph(face, font_size, sdf, ch, &bitmap);
+    Place(g, bitmap);
+  }
+}
+
+const GlyphAtlas::Glyph* GlyphAtlas::GetGlyph(wchar_t ch) {
+  Glyph* g = const_cast<Glyph*>(GetMetrics(ch));
+  if (g->missing) return GetGlyph(0); // 字体里没有的字都共用同一个方框
+  Request(ch, g);
+  return g;
+}
+
+void GlyphAtlas::Prewarm(const std::wstring& text) {
+  for (size_t i = 0; i < text.size(); i++) {
+    wchar_t ch = text[i];
+    if (GetMetrics(ch)->missing) ch = 0;
+    Request(ch, const_cast<Glyph*>(GetMetrics(ch)));
+  }
+}
+
+void GlyphAtlas::CollectRasterized() {
+  if (g_glyph_num_results == 0) return;
+  std::vector<GlyphBitmap> results;
+  {
+    std::lock_guard<std::mutex> lock(g_glyph_mutex);
+    results.swap(g_glyph_results);
+    g_glyph_num_results = 0;
+  }
+  for (const GlyphBitmap& bitmap : results) {
+    Glyph* g = &(glyphs[bitmap.ch]);
+    if (g->state == StateQueued) Place(g, bitmap);
+  }
+  generation++;  // 用了占位框的排版要重做
+}
+
+void PrewarmText(const std::wstring& text) {
+  g_glyph_atlas.Prewarm(text);
+}
+
+// 一串字 -> 每个字两个三角形，每个顶点 (x, y, u, v)，u v 是图集里的像素坐标。
+// D3D 和 GL 的三角形绕向相反
+// 还没光栅化好的字画成占位框，返回是否用了占位框
+static bool BuildTextVertices(const std::wstring& text, float x, float y, float scale, bool d3d, std::vector<float>* out) {
+  out->clear();
+  bool has_placeholder = false;
+  const float k = scale * g_glyph_atlas.quad_scale;  // 图集像素 -> 屏幕像素
+  for (size_t i = 0; i < text.size(); i++) {
+    const GlyphAtlas::Glyph* ch = g_glyph_atlas.GetGlyph(text[i]);
+    const GlyphAtlas::Glyph* quad_src = ch;
+    if (ch->state != GlyphAtlas::StateReady) {
+      quad_src = &(g_glyph_atlas.placeholder);
+      has_placeholder = true;
+    }
+    if (quad_src->size.x > 0 && quad_src->size.y > 0) {
+      const float xpos = x + quad_src->bearing.x * k;
+      const float ypos = y - quad_src->bearing.y * k;
+      const float w = quad_src->size.x * k;
+      const float h = quad_src->size.y * k;
+      const float u0 = float(quad_src->pos.x), v0 = float(quad_src->pos.y);
+      const float u1 = u0 + quad_src->size.x, v1 = v0 + quad_src->size.y;
+      const float gl_quad[6][4] = {
+        { xpos,     ypos + h,   u0, v1 }, //  +-------> +X
+        { xpos + w, ypos,       u1, v0 }, //  |
+        { xpos,     ypos,       u0, v0 }, //  |
+        { xpos,     ypos + h,   u0, v1 }, //  V
+        { xpos + w, ypos + h,   u1, v1 }, //
+        { xpos + w, ypos,       u1, v0 }, //  +Y
+      };
+      const float d3d_quad[6][4] = {
+        { xpos,     ypos + h,   u0, v1 },
+        { xpos,     ypos,       u0, v0 },
+        { xpos + w, ypos,       u1, v0 },
+        { xpos,     ypos + h,   u0, v1 },
+        { xpos + w, ypos,       u1, v0 },
+        { xpos + w, ypos + h,   u1, v1 },
+      };
+      const float* quad = d3d ? &d3d_quad[0][0] : &gl_quad[0][0];
+      out->insert(out->end(), quad, quad + 24);
+    }
+    // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
+    x += (ch->advance >> 6) * scale;
+  }
+  return has_placeholder;
+}
+
+// 排好版的一串字，顶点相对于 (0, 0)，画的时候再平移到 (x, y)。
+// HUD 和菜单里的字每帧都一样，只有内容变了才重新排版；
+// GL 和 D3D11 的顶点只上传一次，之后每帧只是绑定 + 画一次。
+struct TextLayout {
+  int font_size;
+  float scale;
+  bool d3d;
+  std::vector<float> vertices;  // D3D12 每帧要拷进上传缓冲
+  int num_vertices;
+  bool has_placeholder;         // 有字还没光栅化好
+  int generation;               // 对应 GlyphAtlas::generation
+  GLuint vao, vbo;
+#ifdef WIN32
+  ID3D11Buffer* vertex_buffer11;
+#endif
+};
+
+struct TextLayoutEntry {
+  float width;                  // 不乘 scale 的宽度，同 MeasureTextWidth
+  unsigned long long last_used;
+  std::vector<TextLayout> layouts; // 不同的字号和缩放
+};
+
+static std::unordered_map<std::wstring, TextLayoutEntry> g_text_layouts;
+static unsigned long long g_text_layout_tick;
+static const size_t MAX_TEXT_LAYOUTS = 256;  // 超过两倍时清掉最近没用过的
+
+static void FreeTextLayout(TextLayout* layout) {
+  if (layout->vbo) {
+    glDeleteBuffers(1, &layout->vbo);
+    glDeleteVertexArrays(1, &layout->vao);
+    layout->vao = layout->vbo = 0;
+  }
+#ifdef WIN32
+  if (layout->vertex_buffer11) {
+    layout->vertex_buffer11->Release();
+    layout->vertex_buffer11 = nullptr;
+  }
+#endif
+}
+
+static void ClearTextLayouts() {
+  for (auto& kv : g_text_layouts) {
+    for (TextLayout& layout : kv.second.layouts) FreeTextLayout(&layout);
+  }
+  g_text_layouts.clear();
+}
+
+static void EvictTextLayouts() {
+  for (auto itr = g_text_layouts.begin(); itr != g_text_layouts.end(); ) {
+    if (itr->second.last_used + MAX_TEXT_LAYOUTS < g_text_layout_tick) {
+      for (TextLayout& layout : itr->second.layouts) FreeTextLayout(&layout);
+      itr = g_text_layouts.erase(itr);
+    }
+    else itr++;
+  }
+}
+
+static TextLayout* GetTextLayout(const std::wstring& text, float scale, bool d3d) {
+  g_glyph_atlas.CollectRasterized();
+  g_text_layout_tick++;
+  if (g_text_layouts.size() > MAX_TEXT_LAYOUTS * 2) EvictTextLayouts();
+
+  TextLayoutEntry* entry;
+  auto itr = g_text_layouts.find(text);
+  if (itr != g_text_layouts.end()) {
+    entry = &(itr->second);
+  } else {
+    entry = &(g_text_layouts[text]);
+    entry->width = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+      entry->width += g_glyph_atlas.GetMetrics(text[i])->advance / 64.0f;
+    }
+  }
+  entry->last_used = g_text_layout_tick;
+
+  const int font_size = g_glyph_atlas.font_size;
+  for (TextLayout& layout : entry->layouts) {
+    if (layout.font_size == font_size && layout.scale == scale && layout.d3d == d3d) {
+      if (layout.has_placeholder && layout.generation != g_glyph_atlas.generation) {
+        // 有字刚光栅化好，重新排
+        FreeTextLayout(&layout);
+        layout.generation = g_glyph_atlas.generation;
+        layout.has_placeholder = BuildTextVertices(text, 0, 0, scale, d3d, &layout.vertices);
+        layout.num_vertices = int(layout.vertices.size() / 4);
+      }
+      return &layout;
+    }
+  }
+
+  TextLayout layout = { };
+  layout.font_size = font_size;
+  layout.scale = scale;
+  layout.d3d = d3d;
+  layout.generation = g_glyph_atlas.generation;
+  layout.has_placeholder = BuildTextVertices(text, 0, 0, scale, d3d, &layout.vertices);
+  layout.num_vertices = int(layout.vertices.size() / 4);
+  entry->layouts.push_back(layout);
+  return &(entry->layouts.back());
+}
+
 void do_InitCommon() {
   // Face
   FT_Library ft;
@@ -49,55 +559,48 @@ void do_InitCommon() {
     "/usr/share/fonts/truetype/arphic/uming.ttc",
     "C:\\Windows\\Fonts\\simsun.ttc",
   };
+  const char* font_file = nullptr;
   for (int i = 0; i < 2; i++) {
     if (FT_New_Face(ft,
       ttfs[i],
       0, &g_face)) {
       printf("Error: cannot load font file #%d=%s\n", i, ttfs[i]);
     }
-    else break;
+    else {
+      font_file = ttfs[i];
+      break;
+    }
   }
   FT_Set_Pixel_Sizes(g_face, 0, g_font_size);
+  g_glyph_atlas.Init(g_face, font_file);
 }
 
 void InitTextRender() {
-	// VAO
-	glGenVertexArrays(1, &vao);
-	glGenBuffers(1, &vbo);
-
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, nullptr, GL_DYNAMIC_DRAW);
-	glEnableVertexAttribArray(0);
-	//                index size  type  normalized  stride        pointer
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
+  // VAO 和 VBO 在 TextLayout 里，每串字一个
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+  const GLuint program = g_programs[6];
+  g_text_gl.program    = program;
+  g_text_gl.text_color = glGetUniformLocation(program, "textColor");
+  g_text_gl.screensize = glGetUniformLocation(program, "screensize");
+  g_text_gl.transform  = glGetUniformLocation(program, "transform");
+  g_text_gl.projection = glGetUniformLocation(program, "projection");
+  g_text_gl.offset     = glGetUniformLocation(program, "offset");
+  g_text_gl.sdf        = glGetUniformLocation(program, "sdf");
+
   do_InitCommon();
 }
 
 #ifdef WIN32
 void InitTextRender_D3D11() {
-  // Declare a dynamic Vertex Buffer
-  // 4 floats per vertex, 3 vertex per triangle, 2 triangles per character, so 6*4
+  // Vertex Buffer 在 TextLayout 里，每串字一个
   D3D11_BUFFER_DESC desc = { };
-  desc.ByteWidth = sizeof(float) * 6 * 4;
-  desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-  desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-  desc.MiscFlags = 0;
-  desc.StructureByteStride = sizeof(float) * 4;
-  desc.Usage = D3D11_USAGE_DYNAMIC;
-
-  assert(SUCCEEDED(g_device11->CreateBuffer(&desc, nullptr, &vertex_buffer11)));
-
   desc.ByteWidth = sizeof(TextCbPerScene);
   desc.StructureByteStride = sizeof(TextCbPerScene);
   desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+  desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  desc.MiscFlags = 0;
+  desc.Usage = D3D11_USAGE_DYNAMIC;
   assert(SUCCEEDED(g_device11->CreateBuffer(&desc, nullptr, &textcb_perscene11)));
 
   // Create Input Layout
@@ -112,149 +615,139 @@ void InitTextRender_D3D11() {
 }
 #endif
 
-Character GetCharacter(wchar_t ch) {
-	if (g_characters.find(ch) == g_characters.end()) {
-		if (FT_Load_Char(g_face, ch, FT_LOAD_RENDER)) {
-			printf("Oh! Could not load character for rendering.\n");
-		}
-		GLuint texture;
-		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RED,
-			g_face->glyph->bitmap.width,
-			g_face->glyph->bitmap.rows,
-			0,
-			GL_RED,
-			GL_UNSIGNED_BYTE,
-			g_face->glyph->bitmap.buffer
-		);
+// 传了返回 true；会把 GL_TEXTURE_2D 解绑
+static bool UploadAtlas_GL() {
+  GlyphAtlas& atlas = g_glyph_atlas;
+  if (g_atlas_tex == 0) {
+    glGenTextures(1, &g_atlas_tex);
+    atlas.resized = true;
+  }
+  if (!atlas.NeedsUpload()) return false;
+  glBindTexture(GL_TEXTURE_2D, g_atlas_tex);
+  if (atlas.resized) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, atlas.width, atlas.height, 0,
+      GL_RED, GL_UNSIGNED_BYTE, atlas.pixels.data());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    Character character = {
-			texture,
-			glm::ivec2(g_face->glyph->bitmap.width, g_face->glyph->bitmap.rows),
-			glm::ivec2(g_face->glyph->bitmap_left, g_face->glyph->bitmap_top),
-			(GLuint)(g_face->glyph->advance.x)
-		};
-		g_characters[ch] = character;
-
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-	return g_characters[ch];
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, atlas.dirty_y0, atlas.width, atlas.dirty_y1 - atlas.dirty_y0,
+      GL_RED, GL_UNSIGNED_BYTE, &atlas.pixels[atlas.dirty_y0 * atlas.width]);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  atlas.MarkUploaded();
+  return true;
 }
 
 #ifdef WIN32
-Character_D3D11 GetCharacter_D3D11(wchar_t ch) {
-  if (g_characters_d3d11.find(ch) == g_characters_d3d11.end()) {
-    if (FT_Load_Char(g_face, ch, FT_LOAD_RENDER)) {
-      printf("Oh! Could not load character for rendering.\n");
-    }
-
-    ID3D11Texture2D* tex = nullptr;
-    ID3D11ShaderResourceView *srv = nullptr;
-    int W = 0, H = 0;
-
-    if (g_face->glyph->bitmap.buffer) {
-      W = g_face->glyph->bitmap.width;
-      H = g_face->glyph->bitmap.rows;
-
-      D3D11_TEXTURE2D_DESC d2d = { };
-      d2d.MipLevels = 1;
-      d2d.Format = DXGI_FORMAT_R8_UNORM;
-      d2d.Width = W;
-      d2d.Height = H;
-      d2d.ArraySize = 1;
-      d2d.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-      d2d.SampleDesc.Count = 1;
-      d2d.SampleDesc.Quality = 0;
-
-      D3D11_SUBRESOURCE_DATA sd = { };
-      sd.pSysMem = g_face->glyph->bitmap.buffer;
-      sd.SysMemPitch = W; // Line distance
-
-      assert(SUCCEEDED(g_device11->CreateTexture2D(&d2d, &sd, &tex)));
-
-      D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = { };
-      srv_desc.Format = DXGI_FORMAT_R8_UNORM;
-      srv_desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-      srv_desc.Texture2D.MipLevels = 1;
-      assert(SUCCEEDED(g_device11->CreateShaderResourceView(tex, &srv_desc, &srv)));
-    }
-
-    // texture, srv, size, bearing, advance
-    Character_D3D11 character_d3d11 = {
-      tex, srv,
-      glm::ivec2(W, H),
-      glm::ivec2(g_face->glyph->bitmap_left, g_face->glyph->bitmap_top),
-      (GLuint)(g_face->glyph->advance.x)
-    };
-    g_characters_d3d11[ch] = character_d3d11;
+static void UploadAtlas_D3D11() {
+  GlyphAtlas& atlas = g_glyph_atlas;
+  if (g_atlas_tex11 == nullptr) atlas.resized = true;
+  if (!atlas.NeedsUpload()) return;
+  if (atlas.resized) {
+    if (g_atlas_srv11) g_atlas_srv11->Release();
+    if (g_atlas_tex11) g_atlas_tex11->Release();
+
+    D3D11_TEXTURE2D_DESC d2d = { };
+    d2d.MipLevels = 1;
+    d2d.Format = DXGI_FORMAT_R8_UNORM;
+    d2d.Width = atlas.width;
+    d2d.Height = atlas.height;
+    d2d.ArraySize = 1;
+    d2d.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    d2d.SampleDesc.Count = 1;
+    d2d.SampleDesc.Quality = 0;
+
+    D3D11_SUBRESOURCE_DATA sd = { };
+    sd.pSysMem = atlas.pixels.data();
+    sd.SysMemPitch = atlas.width; // Line distance
+    assert(SUCCEEDED(g_device11->CreateTexture2D(&d2d, &sd, &g_atlas_tex11)));
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = { };
+    srv_desc.Format = DXGI_FORMAT_R8_UNORM;
+    srv_desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+    srv_desc.Texture2D.MipLevels = 1;
+    assert(SUCCEEDED(g_device11->CreateShaderResourceView(g_atlas_tex11, &srv_desc, &g_atlas_srv11)));
+  } else {
+    D3D11_BOX box = { 0, UINT(atlas.dirty_y0), 0, UINT(atlas.width), UINT(atlas.dirty_y1), 1 };
+    g_context11->UpdateSubresource(g_atlas_tex11, 0, &box,
+      &atlas.pixels[atlas.dirty_y0 * atlas.width], atlas.width, 0);
   }
-
-  return g_characters_d3d11[ch];
+  atlas.MarkUploaded();
 }
 #endif
 
+// 只用到字宽，不会光栅化，也不碰 GPU
 void MeasureTextWidth(std::wstring text, float *w) {
+  auto itr = g_text_layouts.find(text);
+  if (itr != g_text_layouts.end()) {
+    *w = itr->second.width;
+    return;
+  }
   float ret = 0.0f;
   for (std::wstring::const_iterator itr = text.begin();
       itr != text.end(); itr++) {
-    Character ch = GetCharacter(*itr);
-    ret = ret + ch.advance / 64.0f;
+    const GlyphAtlas::Glyph* ch = g_glyph_atlas.GetMetrics(*itr);
+    ret = ret + ch->advance / 64.0f;
   }
   *w = ret;
 }
 
+// 一批字：program、投影、屏幕大小和图集纹理只设一次
+static void BeginTextBatch_GL() {
+  if (g_text_projection_w != WIN_W || g_text_projection_h != WIN_H) {
+    g_text_projection = glm::perspective(60.0f*3.14159f/180.0f, WIN_W*1.0f/WIN_H, 0.1f, 499.0f);
+    g_text_projection_w = WIN_W;
+    g_text_projection_h = WIN_H;
+  }
+  UploadAtlas_GL();
+  glUseProgram(g_text_gl.program);
+  glUniform2f(g_text_gl.screensize, float(WIN_W), float(WIN_H));
+  glUniformMatrix4fv(g_text_gl.projection, 1, GL_FALSE, glm::value_ptr(g_text_projection));
+  glUniform1i(g_text_gl.sdf, g_glyph_atlas.sdf ? 1 : 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, g_atlas_tex);
+  g_text_batch_fresh = true;
+}
+
+static void EndTextBatch_GL() {
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 // https://learnopengl.com/code_viewer.php?code=in-practice/text_rendering
-void do_RenderText(GLuint program, std::wstring text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color, glm::mat4 transform) {
-	glUseProgram(program);
-	glUniform3f(glGetUniformLocation(program, "textColor"), color.x, color.y, color.z);
-	glm::vec2 screensize(WIN_W, WIN_H);
-	glUniform2fv(glGetUniformLocation(program, "screensize"), 1, glm::value_ptr(screensize));
-	glUniformMatrix4fv(glGetUniformLocation(program, "transform"), 1, GL_FALSE, glm::value_ptr(transform));
-  glm::mat4 proj = glm::perspective(60.0f*3.14159f/180.0f, WIN_W*1.0f/WIN_H, 0.1f, 499.0f);
-  glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
-	glActiveTexture(GL_TEXTURE0);
-	glBindVertexArray(vao);
-
-	int idx = 0;
-	for (std::wstring::const_iterator itr = text.begin();
-			itr != text.end(); itr ++) {
-		Character ch = GetCharacter(*itr);
-		GLfloat xpos = x + ch.bearing.x * scale;
-		GLfloat ypos = y - ch.bearing.y * scale;
-
-		GLfloat w = ch.size.x * scale;
-		GLfloat h = ch.size.y * scale;
-		// Update VBO for each character
-		GLfloat vertices[6][4] = {
-			{ xpos,     ypos + h,   0.0, 1.0 }, //  +-------> +X
-			{ xpos + w, ypos,       1.0, 0.0 }, //  |
-			{ xpos,     ypos,       0.0, 0.0 }, //  |
-			{ xpos,     ypos + h,   0.0, 1.0 }, //  V
-			{ xpos + w, ypos + h,   1.0, 1.0 }, //
-			{ xpos + w, ypos,       1.0, 0.0 }, //  +Y
-		};
-		// Render glyph texture over quad
-		glBindTexture(GL_TEXTURE_2D, ch.textureID);
-		// Update content of VBO memory
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); // Be sure to use glBufferSubData and not glBufferData
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		// Render quad
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		// Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-		x += (ch.advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
-		idx ++;
-	}
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+// 整串字在一个 VBO 里，画一次。要在 BeginTextBatch_GL 和 EndTextBatch_GL 之间调用
+void do_RenderText(std::wstring text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color, glm::mat4 transform) {
+  TextLayout* layout = GetTextLayout(text, scale, false);
+  if (layout->num_vertices == 0) return;
+  // 排版时可能收到了新光栅化好的字
+  if (UploadAtlas_GL()) glBindTexture(GL_TEXTURE_2D, g_atlas_tex);
+
+  if (layout->vbo == 0) {
+    glGenVertexArrays(1, &layout->vao);
+    glGenBuffers(1, &layout->vbo);
+    glBindVertexArray(layout->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, layout->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * layout->vertices.size(), layout->vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    //                index size  type  normalized  stride        pointer
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  if (g_text_batch_fresh || color != g_text_last_color) {
+    glUniform3f(g_text_gl.text_color, color.x, color.y, color.z);
+    g_text_last_color = color;
+  }
+  if (g_text_batch_fresh || transform != g_text_last_transform) {
+    glUniformMatrix4fv(g_text_gl.transform, 1, GL_FALSE, glm::value_ptr(transform));
+    g_text_last_transform = transform;
+  }
+  g_text_batch_fresh = false;
+  glUniform2f(g_text_gl.offset, x, y);
+  glBindVertexArray(layout->vao);
+  glDrawArrays(GL_TRIANGLES, 0, layout->num_vertices);
 }
 
 #ifdef WIN32
@@ -263,9 +756,24 @@ void do_RenderText_D3D11(std::wstring text, float x, float y, float scale, glm::
   g_context11->IASetInputLayout(input_layout11);
   g_context11->VSSetShader(g_vs_textrender, nullptr, 0);
   g_context11->PSSetShader(g_ps_textrender, nullptr, 0);
+  TextLayout* layout = GetTextLayout(text, scale, true);
+  if (layout->num_vertices == 0) return;
+  UploadAtlas_D3D11();
+
+  if (layout->vertex_buffer11 == nullptr) {
+    D3D11_BUFFER_DESC desc = { };
+    desc.ByteWidth = sizeof(float) * layout->vertices.size();
+    desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    desc.StructureByteStride = sizeof(float) * 4;
+    desc.Usage = D3D11_USAGE_IMMUTABLE;
+    D3D11_SUBRESOURCE_DATA sd = { };
+    sd.pSysMem = layout->vertices.data();
+    assert(SUCCEEDED(g_device11->CreateBuffer(&desc, &sd, &layout->vertex_buffer11)));
+  }
+
   unsigned stride = sizeof(float) * 4;
   unsigned zero = 0;
-  g_context11->IASetVertexBuffers(0, 1, &vertex_buffer11, &stride, &zero);
+  g_context11->IASetVertexBuffers(0, 1, &layout->vertex_buffer11, &stride, &zero);
   float blend_factor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
   g_context11->OMSetBlendState(g_blendstate11, blend_factor, 0xFFFFFFFF);
   g_context11->VSSetConstantBuffers(0, 1, &textcb_perscene11);
@@ -280,39 +788,17 @@ void do_RenderText_D3D11(std::wstring text, float x, float y, float scale, glm::
   cb_perscene.textcolor.m128_f32[0] = color.x;
   cb_perscene.textcolor.m128_f32[1] = color.y;
   cb_perscene.textcolor.m128_f32[2] = color.z;
+  cb_perscene.offset.m128_f32[0] = x;
+  cb_perscene.offset.m128_f32[1] = y;
+  cb_perscene.sdf_params.m128_f32[0] = g_glyph_atlas.sdf ? 1.0f : 0.0f;
 
   D3D11_MAPPED_SUBRESOURCE mapped;
   assert(SUCCEEDED(g_context11->Map(textcb_perscene11, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)));
   memcpy(mapped.pData, &cb_perscene, sizeof(cb_perscene));
   g_context11->Unmap(textcb_perscene11, 0);
 
-  for (int i = 0; i<int(text.size()); i++) {
-    Character_D3D11 ch = GetCharacter_D3D11(text[i]);
-
-    if (ch.srv != nullptr) {
-
-      float xpos = x + ch.bearing.x * scale;
-      float ypos = y - ch.bearing.y * scale;
-      float w = ch.size.x * scale;
-      float h = ch.size.y * scale;
-
-      float vertices[6][4] = {
-        { xpos,     ypos + h,   0.0, 1.0 }, //  +-------> +X
-        { xpos,     ypos,       0.0, 0.0 }, //  |
-        { xpos + w, ypos,       1.0, 0.0 }, //  |
-        { xpos,     ypos + h,   0.0, 1.0 }, //  V
-        { xpos + w, ypos,       1.0, 0.0 }, //  
-        { xpos + w, ypos + h,   1.0, 1.0 }, //  +Y
-      };
-      assert(SUCCEEDED(g_context11->Map(vertex_buffer11, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)));
-      memcpy(mapped.pData, vertices, sizeof(vertices));
-      g_context11->Unmap(vertex_buffer11, 0);
-      g_context11->PSSetShaderResources(0, 1, &ch.srv);
-      g_context11->Draw(6, 0);
-    }
-
-    x += (ch.advance >> 6) * scale;
-  }
+  g_context11->PSSetShaderResources(0, 1, &g_atlas_srv11);
+  g_context11->Draw(layout->num_vertices, 0);
 }
 
 // For DX12
@@ -329,7 +815,7 @@ void TextPass::AllocateConstantBuffers(int n) {
 
   D3D12_DESCRIPTOR_HEAP_DESC desc{};
   desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-  desc.NumDescriptors = num_max_chars;
+  desc.NumDescriptors = 1;  // 只有图集
   desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 
   CE(device12->CreateDescriptorHeap(&desc, IID_PPV_ARGS(&srv_heap)));
@@ -458,6 +944,7 @@ void TextPass::InitFreetype() {
     "/usr/share/fonts/truetype/arphic/uming.ttc",
     "C:\\Windows\\Fonts\\simsun.ttc",
   };
+  const char* font_file = nullptr;
   for (int i = 0; i < 2; i++) {
     if (FT_New_Face(ft,
       ttfs[i],
@@ -466,30 +953,31 @@ void TextPass::InitFreetype() {
     }
     else {
       printf("Font file #%d=%s: load complete\n", i, ttfs[i]);
+      font_file = ttfs[i];
       break;
     }
   }
   FT_Set_Pixel_Sizes(face, 0, 20);
   g_face = face;
+  g_glyph_atlas.Init(face, font_file);
 }
 
-Character_D3D12* TextPass::CreateOrGetChar(wchar_t ch) {
-  if (characters_d3d12.count(ch) > 0) {
-    return &(characters_d3d12.at(ch));
-  }
+// 整张图集重新传一遍；只在出现新字的那一帧发生
+// 上一帧已经 WaitForPreviousFrame 了，旧的纹理和上传缓冲可以直接释放
+void TextPass::UploadAtlas() {
+  GlyphAtlas& atlas = g_glyph_atlas;
+  if (atlas_texture == nullptr) atlas.resized = true;
+  if (!atlas.NeedsUpload()) return;
 
-  if (FT_Load_Char(face, ch, FT_LOAD_RENDER)) {
-    printf("Oh! Could not load character for rendering.\n");
-  }
-
-  if (face->glyph->bitmap.buffer) {
-    const int W = face->glyph->bitmap.width;
-    const int H = face->glyph->bitmap.rows;
+  const D3D12_RESOURCE_STATES srv_state =
+    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+  if (atlas.resized) {
+    if (atlas_texture) atlas_texture->Release();
+    if (atlas_upload) atlas_upload->Release();
 
     // https://www.braynzarsoft.net/viewtutorial/q16390-directx-12-textures-from-file
-    ID3D12Resource* rsrc, * intermediate;
     D3D12_RESOURCE_DESC tex_desc = CD3DX12_RESOURCE_DESC::Tex2D(
-      DXGI_FORMAT_R8_UNORM, W, H, 1, 0, 1, 0,
+      DXGI_FORMAT_R8_UNORM, atlas.width, atlas.height, 1, 0, 1, 0,
       D3D12_RESOURCE_FLAG_NONE);
     CE(device12->CreateCommittedResource(
       &keep(CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT)),
@@ -497,64 +985,65 @@ Character_D3D12* TextPass::CreateOrGetChar(wchar_t ch) {
       &tex_desc,
       D3D12_RESOURCE_STATE_COPY_DEST,
       nullptr,
-      IID_PPV_ARGS(&rsrc)));
+      IID_PPV_ARGS(&atlas_texture)));
+    atlas_texture->SetName(L"Glyph Atlas");
     uint64_t tex_upload_buffer_size;
     device12->GetCopyableFootprints(&tex_desc, 0, 1, 0, nullptr, nullptr, nullptr, &tex_upload_buffer_size);
-    printf("Tex upload buffer size: %llu\n", tex_upload_buffer_size);
 
     CE(device12->CreateCommittedResource(
-      &keep(CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD)), // upload heap
-      D3D12_HEAP_FLAG_NONE, // no flags
-      &keep(CD3DX12_RESOURCE_DESC::Buffer(tex_upload_buffer_size)), // resource description for a buffer (storing the image data in this heap just to copy to the default heap)
-      D3D12_RESOURCE_STATE_GENERIC_READ, // We will copy the contents from this heap to the default heap above
+      &keep(CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD)),
+      D3D12_HEAP_FLAG_NONE,
+      &keep(CD3DX12_RESOURCE_DESC::Buffer(tex_upload_buffer_size)),
+      D3D12_RESOURCE_STATE_GENERIC_READ,
       nullptr,
-      IID_PPV_ARGS(&intermediate)));
-
-    D3D12_SUBRESOURCE_DATA tex_data = {};
-    tex_data.pData = face->glyph->bitmap.buffer;
-    tex_data.RowPitch = W;
-    tex_data.SlicePitch = W * H;
-    CE(command_list->Reset(command_allocator, pipeline_state));
-    ::UpdateSubresources(command_list, rsrc, intermediate, 0, 0, 1, &tex_data);
-    command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
-      rsrc, D3D12_RESOURCE_STATE_COPY_DEST,
-      D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)));
-    CE(command_list->Close());
-    command_queue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&command_list);
-
-    CD3DX12_CPU_DESCRIPTOR_HANDLE srv_handle(srv_heap->GetCPUDescriptorHandleForHeapStart());
-    int offset = int(characters_d3d12.size());
-    srv_handle.Offset(offset, srv_descriptor_size);
+      IID_PPV_ARGS(&atlas_upload)));
+
     D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
     srv_desc.Format = DXGI_FORMAT_R8_UNORM;
     srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
     srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
     srv_desc.Texture2D.MostDetailedMip = 0;
     srv_desc.Texture2D.MipLevels = 1;
-    device12->CreateShaderResourceView(rsrc, &srv_desc, srv_handle);
+    device12->CreateShaderResourceView(atlas_texture, &srv_desc, srv_heap->GetCPUDescriptorHandleForHeapStart());
+  } else {
+    command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
+      atlas_texture, srv_state, D3D12_RESOURCE_STATE_COPY_DEST)));
+  }
 
-    Character_D3D12 ch12;
-    ch12.texture = rsrc;
-    ch12.size = glm::ivec2(W, H);
-    ch12.bearing = glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top);
-    ch12.advance = face->glyph->advance.x;
-    ch12.offset_in_srv_heap = offset;
+  D3D12_SUBRESOURCE_DATA tex_data = {};
+  tex_data.pData = atlas.pixels.data();
+  tex_data.RowPitch = atlas.width;
+  tex_data.SlicePitch = atlas.width * atlas.height;
+  ::UpdateSubresources(command_list, atlas_texture, atlas_upload, 0, 0, 1, &tex_data);
+  command_list->ResourceBarrier(1, &keep(CD3DX12_RESOURCE_BARRIER::Transition(
+    atlas_texture, D3D12_RESOURCE_STATE_COPY_DEST, srv_state)));
+  atlas.MarkUploaded();
+}
 
-    characters_d3d12[ch] = ch12;
-    return &(characters_d3d12.at(ch));
+void TextPass::RecordRenderCommands() {
+  UploadAtlas();
+  if (batches.empty()) return;
+
+  command_list->SetGraphicsRootDescriptorTable(1, srv_heap->GetGPUDescriptorHandleForHeapStart());
+  D3D12_VERTEX_BUFFER_VIEW vbv{};
+  vbv.BufferLocation = vertex_buffers->GetGPUVirtualAddress();
+  vbv.StrideInBytes = sizeof(float) * 4;
+  vbv.SizeInBytes = sizeof(float) * 4 * num_vertices;
+  command_list->IASetVertexBuffers(0, 1, &vbv);
+  for (const TextBatch& b : batches) {
+    command_list->SetGraphicsRootConstantBufferView(0, per_scene_cbs->GetGPUVirtualAddress() + sizeof(TextCbPerScene) * b.per_scene_cb_index);
+    command_list->DrawInstanced(b.num_vertices, 1, b.first_vertex, 0);
   }
-  else return nullptr;
 }
 
 void TextPass::AddText(std::wstring text, float x, float y, float scale, glm::vec3 color, glm::mat4 transform) {
   bool need_new_perscene_cb = false;
   if (num_per_scene_cbs == 0 || color != last_color || transform != last_transform) {
     need_new_perscene_cb = true;
-    last_color = color;
-    last_transform = transform;
   }
 
   if (need_new_perscene_cb) {
+    if (num_per_scene_cbs >= num_max_chars) return;
     TextCbPerScene cb_perscene = { };
     cb_perscene.screensize.m128_f32[0] = WIN_W;
     cb_perscene.screensize.m128_f32[1] = WIN_H;
@@ -564,6 +1053,7 @@ void TextPass::AddText(std::wstring text, float x, float y, float scale, glm::ve
     cb_perscene.textcolor.m128_f32[0] = color.x;
     cb_perscene.textcolor.m128_f32[1] = color.y;
     cb_perscene.textcolor.m128_f32[2] = color.z;
+    cb_perscene.sdf_params.m128_f32[0] = g_glyph_atlas.sdf ? 1.0f : 0.0f;
 
     CD3DX12_RANGE readRange(0, 0);
     size_t offset = sizeof(TextCbPerScene) * num_per_scene_cbs;
@@ -574,64 +1064,87 @@ void TextPass::AddText(std::wstring text, float x, float y, float scale, glm::ve
     per_scene_cbs->Unmap(0, &writeRange);
 
     num_per_scene_cbs++;
+    last_color = color;
+    last_transform = transform;
   }
 
   const int per_scene_cb_index = num_per_scene_cbs - 1;
 
-  for (size_t i = 0; i < text.size(); i++) {
-    wchar_t ch = text.at(i);
-    Character_D3D12* ch12 = CreateOrGetChar(ch);
-    if (ch12 == nullptr) {  // Space
-      x += 8 * scale;
-      continue;
-    }
-
-    float xpos = x + ch12->bearing.x * scale;
-    float ypos = y - ch12->bearing.y * scale;
-    float w = ch12->size.x * scale;
-    float h = ch12->size.y * scale;
-    x = xpos + w;
-
-    float vertices[6][4] = {
-        { xpos,     ypos + h,   0.0, 1.0 }, //  +-------> +X
-        { xpos,     ypos,       0.0, 0.0 }, //  |
-        { xpos + w, ypos,       1.0, 0.0 }, //  |
-        { xpos,     ypos + h,   0.0, 1.0 }, //  V
-        { xpos + w, ypos,       1.0, 0.0 }, //  
-        { xpos + w, ypos + h,   1.0, 1.0 }, //  +Y
-    };
-
-    const int size = sizeof(vertices);
-    const int offset = characters_to_display.size() * size;
-    UINT8* pData;
-    CD3DX12_RANGE readRange(0, 0);
-    CE(vertex_buffers->Map(0, &readRange, (void**)&pData));
-    memcpy(pData + offset, vertices, size);
-    CD3DX12_RANGE writeRange(offset, offset + size);
-    vertex_buffers->Unmap(0, &writeRange);
-
-    D3D12_VERTEX_BUFFER_VIEW vbv{};
-    vbv.BufferLocation = vertex_buffers->GetGPUVirtualAddress() + offset;
-    vbv.StrideInBytes = sizeof(float) * 4;
-    vbv.SizeInBytes = sizeof(vertices);
-
-    CharacterToDisplay ctd{};
-    ctd.character = ch12;
-    ctd.vbv = vbv;
-    ctd.per_scene_cb_index = per_scene_cb_index;
-    characters_to_display.push_back(ctd);
+  // 上传缓冲每帧重写，所以在这里把排好的字平移过去
+  const TextLayout* layout = GetTextLayout(text, scale, true);
+  int n = layout->num_vertices;
+  if (num_vertices + n > num_max_chars * 6) {
+    n = num_max_chars * 6 - num_vertices;
+  }
+  if (n <= 0) return;
+
+  const int offset = sizeof(float) * 4 * num_vertices, size = sizeof(float) * 4 * n;
+  UINT8* pData;
+  CD3DX12_RANGE readRange(0, 0);
+  CE(vertex_buffers->Map(0, &readRange, (void**)&pData));
+  float* dst = (float*)(pData + offset);
+  const float* src = layout->vertices.data();
+  for (int i = 0; i < n; i++, dst += 4, src += 4) {
+    dst[0] = src[0] + x;
+    dst[1] = src[1] + y;
+    dst[2] = src[2];
+    dst[3] = src[3];
   }
+  CD3DX12_RANGE writeRange(offset, offset + size);
+  vertex_buffers->Unmap(0, &writeRange);
+
+  if (!batches.empty() && batches.back().per_scene_cb_index == per_scene_cb_index) {
+    batches.back().num_vertices += n;  // 和上一批接得上
+  } else {
+    TextBatch batch{};
+    batch.first_vertex = num_vertices;
+    batch.num_vertices = n;
+    batch.per_scene_cb_index = per_scene_cb_index;
+    batches.push_back(batch);
+  }
+  num_vertices += n;
 }
 
 #endif
 
+static std::vector<TextDrawCall>* g_text_record = nullptr;
+
 void RenderText(GraphicsAPI api, std::wstring text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color, glm::mat4 transform) {
   switch (api) {
 #ifdef WIN32
     case ClimbD3D11: do_RenderText_D3D11(text, x, y, scale, color, transform); break;
     case ClimbD3D12: do_RenderText_D3D12(text, x, y, scale, color, transform); break;
 #endif
-    case ClimbOpenGL: do_RenderText(g_programs[6], text, x, y, scale, color, transform); break;
+    case ClimbOpenGL: {
+      if (g_text_record) {
+        TextDrawCall call = { text, x, y, scale, color, transform };
+        g_text_record->push_back(call);
+      } else {
+        BeginTextBatch_GL();
+        do_RenderText(text, x, y, scale, color, transform);
+        EndTextBatch_GL();
+      }
+      break;
+    }
     default: break;
   }
+}
+
+void BeginRecordText(std::vector<TextDrawCall>* calls) {
+  // 录的时候不排版，这里先收下后台光栅化好的字形，generation 变了调用方才知道要重画
+  g_glyph_atlas.CollectRasterized();
+  g_text_record = calls;
+}
+
+void EndRecordText() {
+  g_text_record = nullptr;
+}
+
+void ReplayText(const std::vector<TextDrawCall>& calls) {
+  if (calls.empty()) return;
+  BeginTextBatch_GL();
+  for (const TextDrawCall& c : calls) {
+    do_RenderText(c.text, c.x, c.y, c.scale, c.color, c.transform);
+  }
+  EndTextBatch_GL();
 }
\ No newline at end of file
@@ -1,13 +1,21 @@
 #include <map>
 #include <string>
 #include <vector>
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#ifdef CYCLIMB_HEADLESS
+typedef struct FT_FaceRec_* FT_Face;
+#else
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#endif
 
 #ifdef WIN32
 #include <d3d11.h>
@@ -15,11 +23,73 @@
 #endif
 #include "util.hpp"
 
-struct Character {
-	GLuint textureID;
-	glm::ivec2 size, bearing;
-	GLuint advance;
+// 所有字形打包进同一张 R8 纹理（一行一行地排），放不下了就把高度加倍，
+// 这样中文字多了也只有一张纹理。这里只管 CPU 端的像素，上传到 GPU 由各后端自己做。
+// 顶点里的 UV 用的是图集里的像素坐标，在 shader 里再除以纹理大小，
+// 所以图集长高了以后之前生成的顶点也还能用。
+//
+// SDF 模式（g_sdf_text）下图集里存的是有符号距离场：字形按 SDF_SIZE 的字号生成，
+// 0.5 是边缘，画的时候按 quad_scale 缩放到实际字号，任何大小和 3D 变换都清楚。
+//
+// 新字在后台线程光栅化，主线程在 CollectRasterized 里把结果放进图集；
+// 还没好的字先画成 placeholder，好了以后用到它的排版会重做。
+// 菜单和提示用到的字可以在启动时 Prewarm。
+struct GlyphBitmap;
+class GlyphAtlas {
+public:
+  struct Glyph {
+    glm::ivec2 size;     // 图集像素
+    glm::vec2 bearing;   // 图集像素
+    GLuint advance;      // 1/64 像素，按实际字号
+    glm::ivec2 pos;      // 在图集中的位置
+    int state;           // GlyphState
+    bool missing;        // 字体里没有，画成 .notdef
+  };
+  enum GlyphState {
+    StateMetricsOnly,    // 只量过宽度
+    StateQueued,         // 在后台线程排队光栅化
+    StateReady,          // 已经在图集里
+  };
+  static const int WIDTH = 1024, INIT_HEIGHT = 256, MAX_HEIGHT = 4096;
+  static const int PADDING = 1;
+  static const int SDF_SIZE = 32, SDF_SPREAD = 4; // 距离场的字号和范围（像素）
+  static const int SDF_HIRES = 4;                 // 先按 4 倍大小光栅化再算距离
+
+  GlyphAtlas() : face(nullptr), font_size(0), sdf(false), quad_scale(1), width(0), height(0), resized(false), dirty_y0(0), dirty_y1(0), generation(0), async(false) { }
+  // 给了 font_file 就另开一个 face 在后台线程光栅化，否则在主线程光栅化
+  void Init(FT_Face _face, const char* font_file = nullptr);
+  const Glyph* GetMetrics(wchar_t ch); // 只要宽度，不光栅化
+  const Glyph* GetGlyph(wchar_t ch);   // 需要时光栅化；后台光栅化时可能还没好，先画 placeholder
+  void Prewarm(const std::wstring& text); // 提前排队，不等结果
+  void CollectRasterized();            // 把后台光栅化好的字放进图集，每帧画字之前调用
+
+  // 给后端上传用
+  bool NeedsUpload() const { return resized || dirty_y1 > dirty_y0; }
+  void MarkUploaded() { resized = false; dirty_y0 = height; dirty_y1 = 0; }
+
+  FT_Face face;
+  int font_size;             // 像素
+  bool sdf;
+  float quad_scale;          // 图集像素 -> 屏幕像素
+  int width, height;
+  std::vector<unsigned char> pixels;
+  bool resized;              // 纹理要重建
+  int dirty_y0, dirty_y1;    // 还没上传的行
+  Glyph placeholder;         // 空心方框
+  int generation;            // 每收到一批光栅化结果加一
+private:
+  void Request(wchar_t ch, Glyph* g);
+  void Place(Glyph* g, const GlyphBitmap& bitmap);
+  void Insert(wchar_t ch, Glyph* g, const unsigned char* bitmap, int pitch);
+  bool Pack(int w, int h, glm::ivec2* pos);
+  bool Grow();
+  std::map<wchar_t, Glyph> glyphs;
+  int shelf_x, shelf_y, shelf_h;
+  bool async;                // 有后台光栅化线程
 };
+extern GlyphAtlas g_glyph_atlas;
+extern bool g_sdf_text;
+void PrewarmText(const std::wstring& text);
 
 #ifdef WIN32
 struct TextCbPerScene {
@@ -27,45 +97,37 @@ struct TextCbPerScene {
   DirectX::XMMATRIX transform;
   DirectX::XMMATRIX projection;
   DirectX::XMVECTOR textcolor;
-};
-
-struct Character_D3D11 {
-  ID3D11Texture2D *texture;
-  ID3D11ShaderResourceView *srv;
-  glm::ivec2 size, bearing;
-  GLuint advance;
-};
-
-struct Character_D3D12 {
-  ID3D12Resource* texture;
-  int offset_in_srv_heap;  // Offset in the number of descriptors
-  glm::ivec2 size, bearing;
-  uint32_t advance;
+  DirectX::XMVECTOR offset;     // 排好版的字相对于 (0, 0)，画的时候平移
+  DirectX::XMVECTOR sdf_params; // x: 1 = SDF 字形
 };
 
 class TextPass {
 public:
   TextPass(ID3D12Device* d, ID3D12CommandQueue* cq, ID3D12GraphicsCommandList* cl, ID3D12CommandAllocator* ca) :
+    atlas_texture(nullptr), atlas_upload(nullptr),
     device12(d), command_queue(cq), command_list(cl), command_allocator(ca) {}
-  struct CharacterToDisplay {
-    Character_D3D12* character;
-    D3D12_VERTEX_BUFFER_VIEW vbv;
+  // 颜色和变换相同、顶点连续的字合成一次 Draw
+  struct TextBatch {
+    int first_vertex, num_vertices;
     int per_scene_cb_index;
   };
 
   void AllocateConstantBuffers(int n);
   void StartPass() {
     num_per_scene_cbs = 0;
-    characters_to_display.clear();
+    num_vertices = 0;
+    batches.clear();
   }
   void InitFreetype();
   void InitD3D12();
-  Character_D3D12* CreateOrGetChar(wchar_t ch);
   void AddText(std::wstring text, float x, float y, float scale, glm::vec3 color, glm::mat4 transform);
+  // 上传图集并画出本帧所有的字。要在 command_list 打开、设好 Root Signature 和 Descriptor Heap 后调用
+  void RecordRenderCommands();
 
   ID3D12RootSignature* root_signature;
   ID3D12PipelineState* pipeline_state;
-  std::vector<CharacterToDisplay> characters_to_display;
+  std::vector<TextBatch> batches;
+  int num_vertices;
 
   int num_max_chars;
 
@@ -81,12 +143,15 @@ public:
   // VBs
   ID3D12Resource* vertex_buffers;
 
-  std::map<wchar_t, Character_D3D12> characters_d3d12;
+  // 图集，SRV 在 srv_heap 的第 0 个
+  ID3D12Resource* atlas_texture;
+  ID3D12Resource* atlas_upload;
   
   FT_Face face;
 
   int srv_descriptor_size;
 private:
+  void UploadAtlas();
   ID3D12Device* device12;
   ID3D12CommandQueue* command_queue;
   ID3D12GraphicsCommandList* command_list;
@@ -99,4 +164,19 @@ void InitTextRender();
 void InitTextRender_D3D11();
 #endif
 void RenderText(GraphicsAPI api, std::wstring text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color, glm::mat4 transform);
+
+// GL 的 UI Pass 先把一帧的 RenderText 记下来，一个字也没有就不用动 UI 的 FBO
+struct TextDrawCall {
+  std::wstring text;
+  float x, y, scale;
+  glm::vec3 color;
+  glm::mat4 transform;
+};
+inline bool operator==(const TextDrawCall& a, const TextDrawCall& b) {
+  return a.text == b.text && a.x == b.x && a.y == b.y && a.scale == b.scale &&
+         a.color == b.color && a.transform == b.transform;
+}
+void BeginRecordText(std::vector<TextDrawCall>* calls); // 之后 GL 的 RenderText 只记录不画
+void EndRecordText();
+void ReplayText(const std::vector<TextDrawCall>& calls);
 void MeasureTextWidth(std::wstring text, float *w);
@@ -1,9 +1,11 @@
 #include "util.hpp"
 #include <fstream>
+#include <algorithm>
 #ifdef WIN32
 #include <Windows.h> // GetTickCount
 #else
 #include <sys/time.h>
+#include <time.h>
 #endif
 
 extern int WIN_W, WIN_H;
@@ -56,6 +58,31 @@ unsigned GetElapsedMillis() {
   #endif
 }
 
+unsigned long long GetElapsedMicros() {
+  #ifdef WIN32
+  static LARGE_INTEGER freq, t0;
+  if (freq.QuadPart == 0) {
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+  }
+  LARGE_INTEGER t1;
+  QueryPerformanceCounter(&t1);
+  return (unsigned long long)((t1.QuadPart - t0.QuadPart) * 1000000 / freq.QuadPart);
+  #else
+  static bool t0_inited = false;
+  static struct timespec t0;
+  if (!t0_inited) {
+    t0_inited = true;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+  }
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (unsigned long long)(t1.tv_sec - t0.tv_sec) * 1000000 +
+         (t1.tv_nsec - t0.tv_nsec) / 1000;
+  #endif
+}
+
+#ifndef CYCLIMB_HEADLESS
 void MyCheckGLError(const char* tag) {
   GLenum err = glGetError();
   if (err != GL_NO_ERROR) {
@@ -131,10 +158,17 @@ void FullScreenQuad::Render(unsigned tex) {
 }
 
 void FullScreenQuad::RenderDepth(unsigned tex) {
+  // 深度图平时开着比较模式，直接看数值要先关掉
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
   glUseProgram(program_depth);
   do_render(tex);
   glUseProgram(0);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
+#endif
 
 float FullScreenQuad::quad_vertices_and_attrib[] = {
   -1.0,  1.0, 0.0, 0.0,
@@ -314,6 +348,54 @@ DirectionalLight::DirectionalLight(const glm::vec3& _dir, const glm::vec3& _pos,
   this->fov = fov;
 }
 
+void DirectionalLight::FitToFrustum(const glm::mat4& cam_PV, const glm::vec3& caster_lb, const glm::vec3& caster_ub) {
+  if (is_spotlight_hack) return;
+  // 都转到光空间里求包围盒
+  const glm::mat4 inv_PV = glm::inverse(cam_PV);
+  glm::vec3 f_lb(1e20f), f_ub(-1e20f), c_lb(1e20f), c_ub(-1e20f);
+  for (int i = 0; i < 8; i++) {
+    const glm::vec4 ndc((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1, 1);
+    glm::vec4 w = inv_PV * ndc;
+    const glm::vec3 f = glm::vec3(V * glm::vec4(glm::vec3(w) / w.w, 1));
+    f_lb = glm::min(f_lb, f); f_ub = glm::max(f_ub, f);
+
+    const glm::vec3 cw((i & 1) ? caster_ub.x : caster_lb.x,
+                       (i & 2) ? caster_ub.y : caster_lb.y,
+                       (i & 4) ? caster_ub.z : caster_lb.z);
+    const glm::vec3 c = glm::vec3(V * glm::vec4(cw, 1));
+    c_lb = glm::min(c_lb, c); c_ub = glm::max(c_ub, c);
+  }
+
+  // XY 取交集；Z 要包住所有投影物，不然视锥外的东西投不过来
+  glm::vec3 lb(std::max(f_lb.x, c_lb.x), std::max(f_lb.y, c_lb.y), c_lb.z);
+  glm::vec3 ub(std::min(f_ub.x, c_ub.x), std::min(f_ub.y, c_ub.y), c_ub.z);
+  if (lb.x >= ub.x || lb.y >= ub.y) { lb = c_lb; ub = c_ub; }
+
+  float extent = std::max(std::max(ub.x - lb.x, ub.y - lb.y), ub.z - lb.z);
+  float step = 1.0f;
+  while (step * 8 < extent) step *= 2;
+  lb = glm::floor(lb / step) * step;
+  ub = glm::ceil(ub / step) * step;
+  lb.z -= step; ub.z += step;  // 包围盒外的粒子之类也别被裁掉
+
+  // 看向 -Z，所以 near/far 是 -ub.z/-lb.z
+  P = glm::ortho(lb.x, ub.x, lb.y, ub.y, -ub.z, -lb.z);
+}
+
+glm::mat4 DirectionalLight::FitToBounds(const glm::vec3& caster_lb, const glm::vec3& caster_ub) const {
+  if (is_spotlight_hack) return P;
+  glm::vec3 lb(1e20f), ub(-1e20f);
+  for (int i = 0; i < 8; i++) {
+    const glm::vec3 cw((i & 1) ? caster_ub.x : caster_lb.x,
+                       (i & 2) ? caster_ub.y : caster_lb.y,
+                       (i & 4) ? caster_ub.z : caster_lb.z);
+    const glm::vec3 c = glm::vec3(V * glm::vec4(cw, 1));
+    lb = glm::min(lb, c); ub = glm::max(ub, c);
+  }
+  lb -= glm::vec3(1.0f); ub += glm::vec3(1.0f);  // 边上的片元别正好落在贴图外
+  return glm::ortho(lb.x, ub.x, lb.y, ub.y, -ub.z, -lb.z);
+}
+
 #ifdef WIN32
 DirectX::XMMATRIX DirectionalLight::GetP_D3D11_DXMath() {
   DirectX::XMMATRIX P_D3D11;
@@ -381,6 +463,7 @@ void PrintMat4(const glm::mat4& m, const char* tag) {
     printf("%5g, %5g, %5g, %5g\n", m[i][0], m[i][1], m[i][2], m[i][3]);
 }
 
+#ifndef CYCLIMB_HEADLESS
 void FullScreenQuad::RenderWithBlend(unsigned tex) {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -389,6 +472,7 @@ void FullScreenQuad::RenderWithBlend(unsigned tex) {
   glDisable(GL_BLEND);
   MyCheckGLError("renderwithblend");
 }
+#endif
 
 std::vector<std::string> ReadLinesFromFile(const char* fn) {
   std::vector<std::string> ret;
@@ -416,6 +500,42 @@ std::vector<std::string> SplitStringBySpace(std::string x) {
   return ret;
 }
 
+LevelArena::~LevelArena() {
+  Reset();
+  for (char* b : blocks) free(b);
+}
+
+void* LevelArena::Allocate(size_t bytes, size_t align) {
+  bytes_used += bytes;
+  if (bytes > BLOCK_SIZE / 4) {
+    char* p = (char*)malloc(bytes);
+    large_blocks.push_back(p);
+    return p;
+  }
+  while (true) {
+    if (curr_block == blocks.size()) {
+      blocks.push_back((char*)malloc(BLOCK_SIZE));
+      offset = 0;
+    }
+    const size_t p = (offset + align - 1) & ~(align - 1);
+    if (p + bytes <= BLOCK_SIZE) {
+      offset = p + bytes;
+      return blocks[curr_block] + p;
+    }
+    curr_block++;
+    offset = 0;
+  }
+}
+
+void LevelArena::Reset() {
+  for (char* b : large_blocks) free(b);
+  large_blocks.clear();
+  curr_block = 0;
+  offset = 0;
+  bytes_used = 0;
+}
+
+#ifdef WIN32
 #include <d3d12.h>
 void CE(HRESULT x) {
   if (FAILED(x)) {
@@ -423,3 +543,4 @@ void CE(HRESULT x) {
     throw std::exception();
   }
 }
+#endif
@@ -1,16 +1,23 @@
 #ifndef _UTIL_HPP
 #define _UTIL_HPP
 
+#ifdef CYCLIMB_HEADLESS
+#include "headless_gl.hpp"
+#else
 #include <gl/glew.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef CYCLIMB_HEADLESS
 #include <GLFW/glfw3.h>
+#endif
 #include <vector>
 #include <string>
 #include "shader.hpp"
 #include <unordered_map>
+#include <type_traits>
 
 #ifdef WIN32
 #include <d3d11.h>
@@ -121,12 +128,61 @@ public:
 #endif
   DirectionalLight(const glm::vec3& _dir, const glm::vec3& _pos);
   DirectionalLight(const glm::vec3& _dir, const glm::vec3& _pos, const glm::vec3& up, const float fov);
+  // 把正交的 P 收到相机视锥和投影物包围盒 [caster_lb, caster_ub]（世界坐标）的交集上。
+  // 边界按范围的 1/8 取整，相机小幅移动时 P 不变（静态阴影的缓存也就不失效）
+  void FitToFrustum(const glm::mat4& cam_PV, const glm::vec3& caster_lb, const glm::vec3& caster_ub);
+  // 只包住投影物包围盒、不看相机的正交 P（不改 this->P）。静态阴影层用，投影物不变它就不变
+  glm::mat4 FitToBounds(const glm::vec3& caster_lb, const glm::vec3& caster_ub) const;
 };
 
 unsigned GetElapsedMillis();
+unsigned long long GetElapsedMicros(); // 高精度，测性能用
+
+// 固定步长模拟，见 main.cpp 中的 Step()
+extern const float SIM_DT;
+unsigned GetSimulationMillis();
+// 以前按每帧调出来的常数（阻尼等）都是在约 60FPS 下调的，按 secs 换算时用
+const float SIM_REF_FPS = 60.0f;
 std::vector<std::string> ReadLinesFromFile(const char* fn);
 std::vector<std::string> SplitStringBySpace(std::string x);
 
+// 单调增长的内存池：Allocate 只往后挪指针，单个释放什么也不做，Reset 一次全部还回去。
+// 块在 Reset 之后留着接着用，所以稳定下来以后不再向系统要内存。放一关之内的数据用。
+class LevelArena {
+public:
+  static const size_t BLOCK_SIZE = 64 * 1024;
+  LevelArena() : curr_block(0), offset(0), bytes_used(0) { }
+  ~LevelArena();
+  void* Allocate(size_t bytes, size_t align);
+  void Reset();
+  size_t BytesUsed() const { return bytes_used; }
+private:
+  LevelArena(const LevelArena&);
+  std::vector<char*> blocks;
+  std::vector<char*> large_blocks; // 超过 BLOCK_SIZE / 4 的单独分配，Reset 时释放
+  size_t curr_block, offset, bytes_used;
+};
+
+// 给标准容器用的分配器，类似 std::pmr::polymorphic_allocator
+// （VS 工程还是 C++14，没有 <memory_resource>）
+template <class T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+  LevelArena* arena;
+  ArenaAllocator(LevelArena* _arena) : arena(_arena) { }
+  template <class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) { }
+  T* allocate(size_t n) { return (T*)(arena->Allocate(sizeof(T) * n, alignof(T))); }
+  void deallocate(T*, size_t) { }
+};
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
 
 // https://stackoverflow.com/questions/65315241/how-can-i-fix-requires-l-value
 template <class T>
@@ -134,6 +190,8 @@ constexpr auto& keep(T&& x) noexcept {
   return x;
 }
 
+#ifdef WIN32
 void CE(HRESULT x);
+#endif
 
 #endif